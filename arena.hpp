@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct ArenaStats {
+  uint64_t mappedBytes;
+  uint64_t usedBytes;
+  uint32_t chunks;
+  uint32_t hugetlbChunks; // chunks backed by reserved MAP_HUGETLB pages
+  int32_t node;           // NUMA node the arena is bound to, -1 if unknown
+};
+
+// Bump allocator over a chain of 2 MB aligned anonymous mappings. Everything
+// an Orderbook owns is carved out of its arena, so its working set sits on a
+// handful of huge pages instead of being scattered across the heap, and it is
+// released in one go when the arena is destroyed; nothing is freed piecemeal.
+//
+// Each chunk is first requested from the reserved huge page pool
+// (MAP_HUGETLB). Where none are reserved it falls back to ordinary pages
+// advised for transparent huge pages. Chunks are bound to the NUMA node of
+// the thread that created the arena, so a book built on a worker stays local
+// to it even when it grows later from another thread.
+class Arena {
+public:
+  static constexpr size_t kHugePage = 2u << 20;
+
+  explicit Arena(size_t initialBytes = kHugePage) : node(current_node()) {
+    add_chunk(initialBytes);
+  }
+
+  ~Arena() {
+    for (Chunk *chunk = last; chunk;) {
+      Chunk *prev = chunk->prev;
+      ::munmap(chunk, chunk->bytes);
+      chunk = prev;
+    }
+  }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Returns uninitialized storage; throws std::bad_alloc if the OS refuses
+  void *allocate(size_t bytes, size_t align = 64) {
+    uintptr_t p = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+    if (p + bytes > end) {
+      add_chunk(bytes + align);
+      p = (cursor + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    cursor = p + bytes;
+    used += bytes;
+    return reinterpret_cast<void *>(p);
+  }
+
+  // Storage for n objects, left uninitialized. Untouched pages stay unbacked
+  // until first written
+  template <typename T> T *allocate_array(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena objects are never destroyed");
+    return static_cast<T *>(
+        allocate(sizeof(T) * n, alignof(T) > 64 ? alignof(T) : 64));
+  }
+
+  // n value-initialized objects
+  template <typename T> T *construct_array(size_t n) {
+    T *array = allocate_array<T>(n);
+    for (size_t i = 0; i < n; ++i)
+      new (&array[i]) T();
+    return array;
+  }
+
+  ArenaStats stats() const {
+    return {mapped, used, chunks, hugetlbChunks, node};
+  }
+
+private:
+  // Header at the start of every chunk, linking it to the one before
+  struct Chunk {
+    Chunk *prev;
+    size_t bytes;
+  };
+
+  static int32_t current_node() {
+#ifdef SYS_getcpu
+    unsigned cpu = 0, numaNode = 0;
+    if (::syscall(SYS_getcpu, &cpu, &numaNode, nullptr) == 0)
+      return (int32_t)numaNode;
+#endif
+    return -1;
+  }
+
+  // Prefers the arena's node for the range; best effort, as mbind fails
+  // without NUMA support and then placement is simply left to the kernel
+  void bind(void *base, size_t bytes) {
+#ifdef SYS_mbind
+    constexpr int kMpolPreferred = 1;
+    constexpr size_t kMaxNodes = 1024;
+    if (node < 0 || (size_t)node >= kMaxNodes)
+      return;
+    unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+    mask[node / (8 * sizeof(unsigned long))] =
+        1ul << (node % (8 * sizeof(unsigned long)));
+    ::syscall(SYS_mbind, base, bytes, kMpolPreferred, mask, kMaxNodes, 0);
+#else
+    (void)base;
+    (void)bytes;
+#endif
+  }
+
+  // Maps a new chunk with room for at least bytes past its header. Chunks
+  // double in size so a growing book maps O(log n) of them
+  void add_chunk(size_t bytes) {
+    size_t size = bytes + sizeof(Chunk);
+    if (size < nextChunk)
+      size = nextChunk;
+    size = (size + kHugePage - 1) & ~(kHugePage - 1);
+
+    bool hugetlb = true;
+    void *base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+      hugetlb = false;
+      base = map_aligned(size);
+    }
+    bind(base, size);
+
+    Chunk *chunk = static_cast<Chunk *>(base);
+    chunk->prev = last;
+    chunk->bytes = size;
+    last = chunk;
+    cursor = reinterpret_cast<uintptr_t>(chunk + 1);
+    end = reinterpret_cast<uintptr_t>(base) + size;
+    mapped += size;
+    ++chunks;
+    hugetlbChunks += hugetlb;
+    nextChunk = size * 2;
+  }
+
+  // Ordinary pages, over-mapped and trimmed to a huge page boundary so the
+  // kernel can back the whole range with transparent huge pages
+  static void *map_aligned(size_t size) {
+    void *raw = ::mmap(nullptr, size + kHugePage, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+      throw std::bad_alloc();
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + kHugePage - 1) & ~(uintptr_t)(kHugePage - 1);
+    if (aligned > start)
+      ::munmap(raw, aligned - start);
+    if (aligned + size < start + size + kHugePage)
+      ::munmap(reinterpret_cast<void *>(aligned + size),
+               start + size + kHugePage - (aligned + size));
+    void *base = reinterpret_cast<void *>(aligned);
+#ifdef MADV_HUGEPAGE
+    ::madvise(base, size, MADV_HUGEPAGE);
+#endif
+    return base;
+  }
+
+  Chunk *last = nullptr;
+  uintptr_t cursor = 0;
+  uintptr_t end = 0;
+  size_t nextChunk = kHugePage;
+  uint64_t mapped = 0;
+  uint64_t used = 0;
+  uint32_t chunks = 0;
+  uint32_t hugetlbChunks = 0;
+  int32_t node;
+};
+
+// Array storage taken from an arena when one is given and from the heap
+// otherwise. Arena storage is reclaimed with the arena, never by the array
+template <typename T> class ArenaArray {
+public:
+  ArenaArray() = default;
+  ArenaArray(Arena *arena, size_t n)
+      : data(arena ? arena->allocate_array<T>(n) : new T[n]), owned(!arena) {}
+  ~ArenaArray() {
+    if (owned)
+      delete[] data;
+  }
+
+  ArenaArray(ArenaArray &&other) noexcept { swap(other); }
+  ArenaArray &operator=(ArenaArray &&other) noexcept {
+    ArenaArray(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  T *get() const { return data; }
+  T &operator[](size_t i) const { return data[i]; }
+  explicit operator bool() const { return data != nullptr; }
+
+private:
+  void swap(ArenaArray &other) {
+    std::swap(data, other.data);
+    std::swap(owned, other.owned);
+  }
+
+  T *data = nullptr;
+  bool owned = false;
+};
@@ -0,0 +1,572 @@
+#include "engine.hpp"
+#include "book_manager.hpp"
+#include "journal.hpp"
+#include "order_ingress.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Benchmarks for the matching engine. Build and run with `make bench`.
+// Usage: ./bench [ops per scenario] [seed]
+// `make instrumentedBench` builds the same benchmarks against an engine built
+// with LLL_INSTRUMENT and adds its counters to each scenario's report.
+//
+// Every scenario drives the extern "C" API with a pre-generated, seeded order
+// flow so that runs are reproducible, times each call individually and prints
+// p50/p99/p99.9/max latency per operation plus overall throughput.
+
+// Timestamps come from read_cycles() in instrument.hpp and are converted to
+// nanoseconds with a rate calibrated against steady_clock at startup.
+static double ticks_per_ns() {
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t c0 = read_cycles();
+  while (std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(50))
+    ;
+  uint64_t c1 = read_cycles();
+  double ns = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - t0)
+                  .count();
+  return (c1 - c0) / ns;
+}
+
+static double gTicksPerNs = 1.0;
+
+// splitmix64: tiny, fast and identical on every platform, unlike the
+// standard distributions
+struct Rng {
+  uint64_t state;
+  explicit Rng(uint64_t seed) : state(seed) {}
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  uint32_t below(uint32_t n) { return (uint32_t)(next() % n); }
+  bool chance(uint32_t percent) { return below(100) < percent; }
+};
+
+// INGRESS is never generated; it labels end-to-end ingress ring samples
+enum class OpKind : uint8_t { MATCH, MODIFY, VOLUME, INGRESS };
+constexpr int kOpKinds = 4;
+static const char *kOpNames[kOpKinds] = {"match_order", "modify_order_by_id",
+                                         "get_volume_at_level",
+                                         "producer to match"};
+
+struct Op {
+  OpKind kind;
+  Order order; // MODIFY uses id/quantity, VOLUME uses side/price
+};
+
+// Builds the op stream for a scenario. Keeps the ids it has sent so that
+// modifies and cancels target orders that were (and may still be) resting.
+struct FlowBuilder {
+  Rng rng;
+  std::vector<Op> ops;
+  std::vector<IdType> sent;
+  IdType nextId = 1;
+
+  explicit FlowBuilder(uint64_t seed) : rng(seed) {}
+
+  void order(Side side, PriceType price, QuantityType quantity) {
+    ops.push_back({OpKind::MATCH, Order{nextId, price, quantity, side}});
+    sent.push_back(nextId++);
+  }
+
+  void modify(QuantityType quantity) {
+    if (sent.empty())
+      return;
+    uint32_t pick = rng.below(sent.size());
+    IdType id = sent[pick];
+    if (quantity == 0) {
+      sent[pick] = sent.back();
+      sent.pop_back();
+    }
+    ops.push_back({OpKind::MODIFY, Order{id, 0, quantity, Side::BUY}});
+  }
+
+  void volume(Side side, PriceType price) {
+    ops.push_back({OpKind::VOLUME, Order{0, price, 0, side}});
+  }
+
+  Side side() { return rng.chance(50) ? Side::BUY : Side::SELL; }
+  QuantityType quantity(uint32_t max) { return 1 + rng.below(max); }
+};
+
+constexpr PriceType kMid = 30000;
+
+// Two-sided flow within a couple of ticks of a fixed mid; most orders cross
+static std::vector<Op> tight_spread(uint64_t seed, uint32_t n) {
+  FlowBuilder f(seed);
+  while (f.ops.size() < n) {
+    uint32_t r = f.rng.below(100);
+    if (r < 60) {
+      Side s = f.side();
+      int offset = (int)f.rng.below(5) - 2;
+      f.order(s, kMid + offset, f.quantity(20));
+    } else if (r < 80) {
+      f.modify(f.rng.chance(50) ? 0 : f.quantity(20));
+    } else {
+      f.volume(f.side(), kMid + (int)f.rng.below(5) - 2);
+    }
+  }
+  return std::move(f.ops);
+}
+
+// Mostly passive adds spread over a thousand levels per side, with occasional
+// marketable orders and depth queries anywhere in the book
+static std::vector<Op> deep_book(uint64_t seed, uint32_t n) {
+  FlowBuilder f(seed);
+  while (f.ops.size() < n) {
+    uint32_t r = f.rng.below(100);
+    Side s = f.side();
+    int depth = 1 + f.rng.below(1000);
+    PriceType passive = s == Side::BUY ? kMid - depth : kMid + depth;
+    if (r < 55) {
+      f.order(s, passive, f.quantity(50));
+    } else if (r < 60) {
+      f.order(s, s == Side::BUY ? kMid + 5 : kMid - 5, f.quantity(100));
+    } else if (r < 75) {
+      f.modify(f.rng.chance(50) ? 0 : f.quantity(50));
+    } else {
+      f.volume(s, passive);
+    }
+  }
+  return std::move(f.ops);
+}
+
+// About nine cancels for every new order, as seen from market makers
+static std::vector<Op> cancel_heavy(uint64_t seed, uint32_t n) {
+  FlowBuilder f(seed);
+  for (int i = 0; i < 2000; ++i) {
+    Side s = f.side();
+    int depth = 1 + f.rng.below(50);
+    f.order(s, s == Side::BUY ? kMid - depth : kMid + depth, f.quantity(50));
+  }
+  while (f.ops.size() < n) {
+    if (f.rng.chance(90) && f.sent.size() > 100) {
+      f.modify(0);
+    } else {
+      Side s = f.side();
+      int depth = 1 + f.rng.below(50);
+      f.order(s, s == Side::BUY ? kMid - depth : kMid + depth, f.quantity(50));
+    }
+  }
+  return std::move(f.ops);
+}
+
+// A thick ladder that is repeatedly swept through many levels and refilled
+static std::vector<Op> aggressive_sweeps(uint64_t seed, uint32_t n) {
+  FlowBuilder f(seed);
+  while (f.ops.size() < n) {
+    Side s = f.side();
+    Side other = s == Side::BUY ? Side::SELL : Side::BUY;
+    // Refill 64 levels on the far side, then sweep through most of them
+    for (int level = 1; level <= 64; ++level) {
+      PriceType p = other == Side::SELL ? kMid + level : kMid - level;
+      f.order(other, p, f.quantity(20));
+      f.order(other, p, f.quantity(20));
+    }
+    f.order(s, s == Side::BUY ? kMid + 64 : kMid - 64, 1000 + f.rng.below(500));
+    f.volume(other, other == Side::SELL ? kMid + 64 : kMid - 64);
+  }
+  return std::move(f.ops);
+}
+
+static void report(const char *scenario, std::vector<uint64_t> (&samples)[kOpKinds],
+                   uint64_t totalTicks, size_t totalOps) {
+  std::printf("%s: %zu ops, %.2f Mops/s\n", scenario, totalOps,
+              totalOps / (totalTicks / gTicksPerNs) * 1e3);
+  for (int k = 0; k < kOpKinds; ++k) {
+    auto &s = samples[k];
+    if (s.empty())
+      continue;
+    std::sort(s.begin(), s.end());
+    auto pct = [&](double p) {
+      return s[std::min(s.size() - 1, (size_t)(p * s.size()))] / gTicksPerNs;
+    };
+    std::printf("  %-20s n=%-9zu p50 %7.1f  p99 %7.1f  p99.9 %8.1f  max %9.1f "
+                "ns\n",
+                kOpNames[k], s.size(), pct(0.50), pct(0.99), pct(0.999),
+                s.back() / gTicksPerNs);
+  }
+}
+
+static void run_scenario(const char *name, const std::vector<Op> &ops) {
+  Orderbook *ob = create_orderbook();
+  std::vector<uint64_t> samples[kOpKinds];
+  for (auto &s : samples)
+    s.reserve(ops.size());
+
+  uint64_t sink = 0;
+  uint64_t total = 0;
+  for (const Op &op : ops) {
+    uint64_t t0 = read_cycles();
+    switch (op.kind) {
+    case OpKind::MATCH:
+      sink += match_order(*ob, op.order);
+      break;
+    case OpKind::MODIFY:
+      modify_order_by_id(*ob, op.order.id, op.order.quantity);
+      break;
+    case OpKind::VOLUME:
+      sink += get_volume_at_level(*ob, op.order.side, op.order.price);
+      break;
+    case OpKind::INGRESS:
+      break;
+    }
+    uint64_t dt = read_cycles() - t0;
+    total += dt;
+    samples[(int)op.kind].push_back(dt);
+  }
+  report(name, samples, total, ops.size());
+  if (instrumentation_enabled())
+    dump_instrument_stats(*ob, stdout);
+  // Keeps the compiler from discarding the calls' results
+  if (sink == 1)
+    std::printf("\n");
+  destroy_orderbook(ob);
+}
+
+// Replays the same flow through the batch entry points, handing each run of
+// consecutive matches or modifies over in one call, and reports throughput
+static void run_batched(const char *name, const std::vector<Op> &ops) {
+  constexpr size_t kBatch = 32;
+  Orderbook *ob = create_orderbook();
+  Order orders[kBatch];
+  uint32_t matches[kBatch];
+  IdType ids[kBatch];
+  QuantityType quantities[kBatch];
+
+  uint64_t sink = 0;
+  uint64_t t0 = read_cycles();
+  for (size_t i = 0; i < ops.size();) {
+    size_t n = 0;
+    OpKind kind = ops[i].kind;
+    for (; i < ops.size() && n < kBatch && ops[i].kind == kind; ++i, ++n) {
+      orders[n] = ops[i].order;
+      ids[n] = ops[i].order.id;
+      quantities[n] = ops[i].order.quantity;
+    }
+    if (kind == OpKind::MATCH) {
+      match_orders(*ob, orders, n, matches);
+      sink += matches[0];
+    } else if (kind == OpKind::MODIFY) {
+      modify_orders_by_id(*ob, ids, quantities, n);
+    } else {
+      for (size_t j = 0; j < n; ++j)
+        sink += get_volume_at_level(*ob, orders[j].side, orders[j].price);
+    }
+  }
+  uint64_t total = read_cycles() - t0;
+  std::printf("%s (batched): %zu ops, %.2f Mops/s\n", name, ops.size(),
+              ops.size() / (total / gTicksPerNs) * 1e3);
+  if (sink == 1)
+    std::printf("\n");
+  destroy_orderbook(ob);
+}
+
+// A long-lived touch level: makers keep joining the best ask behind a standing
+// queue while takers keep lifting its head, so the level never empties but
+// sees millions of fills. Pool usage must stay flat at the queue depth.
+static void bench_touch_level_churn(uint32_t fills, uint32_t depth) {
+  Orderbook *ob = create_orderbook();
+  IdType id = 1;
+  for (uint32_t i = 0; i < depth; ++i)
+    match_order(*ob, Order{id++, 100, 10, Side::SELL});
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < fills; ++i) {
+    match_order(*ob, Order{id++, 100, 10, Side::SELL});
+    match_order(*ob, Order{id++, 100, 10, Side::BUY});
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  PoolStats stats = get_order_pool_stats(*ob);
+  std::printf("touch level churn: %u fills, %.1f ns/op, live %u, high water "
+              "%u, level volume %u\n",
+              fills, ns / (2.0 * fills), stats.inUse, stats.highWater,
+              get_volume_at_level(*ob, Side::SELL, 100));
+  destroy_orderbook(ob);
+}
+
+// Throughput of the sharded book manager as workers are added. The same
+// seeded tight-spread flow is replayed on every symbol, round-robin, from one
+// producer thread.
+static void bench_manager_scaling(uint64_t seed, uint32_t opsPerSymbol) {
+  constexpr uint32_t kSymbols = 64;
+  std::vector<Op> flow = tight_spread(seed, opsPerSymbol);
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (uint32_t workers = 1; workers <= std::max(cores, 2u); workers *= 2) {
+    BookManager manager(kSymbols, workers, 1u << 14, 1u << 12);
+    auto start = std::chrono::steady_clock::now();
+    for (const Op &op : flow) {
+      if (op.kind == OpKind::VOLUME)
+        continue;
+      OrderCommand::Type type = op.kind == OpKind::MATCH
+                                    ? OrderCommand::Type::NEW
+                                    : OrderCommand::Type::MODIFY;
+      for (SymbolId s = 0; s < kSymbols; ++s)
+        manager.submit({s, {type, op.order}});
+    }
+    manager.wait_idle();
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    uint64_t commands = 0;
+    for (const Op &op : flow)
+      commands += op.kind == OpKind::VOLUME ? 0 : kSymbols;
+    std::printf("book manager: %u symbols, %u workers, %.2f Mops/s\n",
+                kSymbols, workers, commands / ns * 1e3);
+  }
+}
+
+// Producer-to-match latency through the ingress ring: a producer thread
+// stamps each command as it is pushed and the matching thread measures the
+// time from that stamp to the command having been applied to the book. The
+// producer keeps one command in flight, waiting for the previous one to be
+// applied before sending the next, so the samples are the ring's handoff
+// latency and never include time spent queued behind earlier commands.
+template <bool Blocking>
+static void bench_ingress_latency(uint64_t seed, uint32_t n) {
+  std::vector<Op> flow = tight_spread(seed, n);
+  flow.erase(std::remove_if(flow.begin(), flow.end(),
+                            [](const Op &op) { return op.kind == OpKind::VOLUME; }),
+             flow.end());
+  std::vector<uint64_t> samples[kOpKinds];
+  samples[(int)OpKind::INGRESS].reserve(flow.size());
+  Orderbook *ob = create_orderbook();
+  SpscQueue<OrderCommand, Blocking> ring(1024);
+  uint64_t sentAt = 0;
+  std::atomic<size_t> applied{0};
+
+  std::thread producer([&] {
+    for (size_t i = 0; i < flow.size(); ++i) {
+      OrderCommand command{flow[i].kind == OpKind::MATCH
+                               ? OrderCommand::Type::NEW
+                               : OrderCommand::Type::MODIFY,
+                           flow[i].order};
+      while (applied.load(std::memory_order_acquire) < i)
+        std::this_thread::yield();
+      // Written before the push that publishes it, so the consumer sees it
+      sentAt = read_cycles();
+      ring.try_push(command);
+    }
+  });
+
+  uint64_t start = read_cycles();
+  OrderCommand command;
+  for (size_t done = 0; done < flow.size();) {
+    size_t got;
+    if constexpr (Blocking)
+      got = ring.wait_pop_batch(&command, 1);
+    else
+      got = ring.try_pop_batch(&command, 1);
+    if (got == 0) {
+      // One core may be shared with the producer; give it a chance to run
+      std::this_thread::yield();
+      continue;
+    }
+    apply_command(*ob, command);
+    samples[(int)OpKind::INGRESS].push_back(read_cycles() - sentAt);
+    applied.store(++done, std::memory_order_release);
+  }
+  uint64_t total = read_cycles() - start;
+  producer.join();
+
+  report(Blocking ? "ingress ring (blocking consumer)"
+                  : "ingress ring (polling consumer)",
+         samples, total, flow.size());
+  destroy_orderbook(ob);
+}
+
+// Cost of journaling on the hot path, then the speed of replaying that
+// journal into a fresh book
+static void bench_journal(uint64_t seed, uint32_t n) {
+  const char *path = "/tmp/lll_bench_journal.bin";
+  std::vector<Op> flow = tight_spread(seed, n);
+  {
+    Orderbook *ob = create_orderbook();
+    JournalWriter journal(path, flow.size());
+    attach_journal(*ob, &journal);
+    uint64_t t0 = read_cycles();
+    for (const Op &op : flow) {
+      if (op.kind == OpKind::MATCH)
+        match_order(*ob, op.order);
+      else if (op.kind == OpKind::MODIFY)
+        modify_order_by_id(*ob, op.order.id, op.order.quantity);
+    }
+    uint64_t total = read_cycles() - t0;
+    std::printf("tight spread (journaled): %zu ops, %.2f Mops/s\n",
+                flow.size(), flow.size() / (total / gTicksPerNs) * 1e3);
+    destroy_orderbook(ob);
+  }
+  JournalReader journal(path);
+  Orderbook *ob = create_orderbook();
+  uint64_t t0 = read_cycles();
+  replay_journal(journal, *ob);
+  uint64_t total = read_cycles() - t0;
+  std::printf("journal replay: %zu records, %.2f Mrecords/s\n", journal.size(),
+              journal.size() / (total / gTicksPerNs) * 1e3);
+  destroy_orderbook(ob);
+  std::remove(path);
+}
+
+// Startup cost: restoring a deep book from a snapshot versus rebuilding it by
+// replaying its order flow
+static void bench_snapshot(uint64_t seed, uint32_t n) {
+  const char *path = "/tmp/lll_bench_snapshot.bin";
+  std::vector<Op> flow = deep_book(seed, n);
+  Orderbook *ob = create_orderbook();
+  uint64_t t0 = read_cycles();
+  for (const Op &op : flow) {
+    if (op.kind == OpKind::MATCH)
+      match_order(*ob, op.order);
+    else if (op.kind == OpKind::MODIFY)
+      modify_order_by_id(*ob, op.order.id, op.order.quantity);
+  }
+  uint64_t rebuild = read_cycles() - t0;
+  t0 = read_cycles();
+  bool saved = save_orderbook_snapshot(*ob, path);
+  uint64_t save = read_cycles() - t0;
+  t0 = read_cycles();
+  Orderbook *restored = saved ? load_orderbook_snapshot(path) : nullptr;
+  uint64_t load = read_cycles() - t0;
+  std::printf("snapshot: %u resting orders, rebuild %.2f ms, save %.2f ms, "
+              "load %.2f ms%s\n",
+              get_order_pool_stats(*ob).inUse, rebuild / gTicksPerNs / 1e6,
+              save / gTicksPerNs / 1e6, load / gTicksPerNs / 1e6,
+              restored ? "" : " (FAILED)");
+  destroy_orderbook(restored);
+  destroy_orderbook(ob);
+  std::remove(path);
+}
+
+// Cost of a pre-trade simulate_match, as a router would run one per candidate
+// order. Every incoming order of the flow is simulated against the live book
+// just before it is matched; only the simulations are timed
+static void bench_simulate(const char *name, const std::vector<Op> &ops) {
+  Orderbook *ob = create_orderbook();
+  SimLevel levels[64];
+  SimResult result = {};
+  result.levels = levels;
+  result.levelCapacity = 64;
+  uint64_t simulated = 0, matches = 0, elapsed = 0;
+  for (const Op &op : ops) {
+    if (op.kind == OpKind::MATCH) {
+      uint64_t t0 = read_cycles();
+      matches += simulate_match(*ob, op.order, &result);
+      elapsed += read_cycles() - t0;
+      ++simulated;
+      match_order(*ob, op.order);
+    } else if (op.kind == OpKind::MODIFY) {
+      modify_order_by_id(*ob, op.order.id, op.order.quantity);
+    }
+  }
+  std::printf("%s simulate_match: %llu calls, %.1f ns/call, %.2f "
+              "matches/call\n",
+              name, (unsigned long long)simulated,
+              elapsed / gTicksPerNs / (simulated ? simulated : 1),
+              (double)matches / (simulated ? simulated : 1));
+  destroy_orderbook(ob);
+}
+
+// Hardware cache misses per match_order call, read from perf_event_open
+// counters that are enabled only around each match, so modifies and the
+// harness itself are not counted. Needs perf events to be permitted
+// (kernel.perf_event_paranoid <= 2); otherwise reports them as unavailable
+static void bench_cache_misses(const char *name, const std::vector<Op> &ops) {
+#ifdef __linux__
+  auto open_counter = [](uint32_t type, uint64_t config, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+  };
+  constexpr uint64_t kReadMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                 PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  int l1 = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | kReadMiss,
+                        -1);
+  int llc = l1 < 0 ? -1
+                   : open_counter(PERF_TYPE_HW_CACHE,
+                                  PERF_COUNT_HW_CACHE_LL | kReadMiss, l1);
+  if (l1 < 0 || llc < 0) {
+    std::printf("%s cache misses: perf events unavailable\n", name);
+    if (l1 >= 0)
+      ::close(l1);
+    return;
+  }
+
+  Orderbook *ob = create_orderbook();
+  uint64_t matches = 0;
+  for (const Op &op : ops) {
+    if (op.kind == OpKind::MATCH) {
+      ::ioctl(l1, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      match_order(*ob, op.order);
+      ::ioctl(l1, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      ++matches;
+    } else if (op.kind == OpKind::MODIFY) {
+      modify_order_by_id(*ob, op.order.id, op.order.quantity);
+    }
+  }
+  uint64_t values[3] = {}; // number of counters, then one value each
+  bool ok = ::read(l1, values, sizeof(values)) == (ssize_t)sizeof(values);
+  if (ok && matches)
+    std::printf("%s cache misses: %llu matches, L1D %.2f / match, "
+                "LLC %.3f / match\n",
+                name, (unsigned long long)matches, (double)values[1] / matches,
+                (double)values[2] / matches);
+  else
+    std::printf("%s cache misses: counters could not be read\n", name);
+  ::close(llc);
+  ::close(l1);
+  destroy_orderbook(ob);
+#else
+  (void)ops;
+  std::printf("%s cache misses: perf events unavailable\n", name);
+#endif
+}
+
+int main(int argc, char **argv) {
+  uint32_t n = argc > 1 ? (uint32_t)std::strtoul(argv[1], nullptr, 10) : 2000000;
+  uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 42;
+  gTicksPerNs = ticks_per_ns();
+  std::printf("seed %llu, %u ops per scenario, %.3f ticks/ns\n",
+              (unsigned long long)seed, n, gTicksPerNs);
+
+  run_scenario("tight spread", tight_spread(seed, n));
+  run_scenario("deep book", deep_book(seed, n));
+  run_scenario("cancel heavy", cancel_heavy(seed, n));
+  run_scenario("aggressive sweeps", aggressive_sweeps(seed, n));
+  run_batched("deep book", deep_book(seed, n));
+  run_batched("cancel heavy", cancel_heavy(seed, n));
+  bench_touch_level_churn(5000000, 1000);
+  bench_manager_scaling(seed, n / 64);
+  bench_ingress_latency<false>(seed, n / 16);
+  bench_ingress_latency<true>(seed, n / 16);
+  bench_journal(seed, n);
+  bench_snapshot(seed, n);
+  bench_simulate("tight spread", tight_spread(seed, n));
+  bench_simulate("aggressive sweeps", aggressive_sweeps(seed, n));
+  bench_cache_misses("deep book", deep_book(seed, n));
+  bench_cache_misses("aggressive sweeps", aggressive_sweeps(seed, n));
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "book_manager.hpp"
+#include <stdexcept>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Pins the calling thread to one core; best effort, failures are ignored
+static void pin_to_core(uint32_t index) {
+#ifdef __linux__
+  unsigned cores = std::thread::hardware_concurrency();
+  if (cores == 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(index % cores, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)index;
+#endif
+}
+
+BookManager::BookManager(uint32_t symbolCount, uint32_t workerCount,
+                         uint32_t queueCapacity, uint32_t orderCapacity)
+    : books(symbolCount) {
+  if (workerCount == 0)
+    workerCount = 1;
+  for (uint32_t i = 0; i < workerCount; ++i)
+    workers.emplace_back(new Worker(queueCapacity));
+
+  // Each worker allocates the books it owns from its own thread, so their
+  // memory is first touched on (and placed near) the core that uses it
+  std::atomic<uint32_t> ready{0};
+  for (uint32_t i = 0; i < workerCount; ++i) {
+    workers[i]->thread = std::thread([this, i, orderCapacity, &ready] {
+      pin_to_core(i);
+      for (size_t s = i; s < books.size(); s += workers.size())
+        books[s].reset(new Orderbook(orderCapacity));
+      ready.fetch_add(1, std::memory_order_release);
+      run(i);
+    });
+  }
+  while (ready.load(std::memory_order_acquire) != workerCount)
+    std::this_thread::yield();
+}
+
+BookManager::~BookManager() {
+  running.store(false, std::memory_order_release);
+  for (auto &worker : workers)
+    worker->thread.join();
+}
+
+bool BookManager::try_submit(const BookCommand &command) {
+  // Checked here, on the submitting thread, since the worker indexes books
+  // without checking
+  if (command.symbol >= books.size())
+    throw std::out_of_range("Unknown symbol");
+  Worker &worker = *workers[worker_for(command.symbol)];
+  if (!worker.queue.try_push(command))
+    return false;
+  ++worker.submitted;
+  return true;
+}
+
+void BookManager::submit(const BookCommand &command) {
+  while (!try_submit(command))
+    std::this_thread::yield();
+}
+
+void BookManager::wait_idle() {
+  for (auto &worker : workers) {
+    while (worker->processed.load(std::memory_order_acquire) !=
+           worker->submitted)
+      std::this_thread::yield();
+  }
+}
+
+uint64_t BookManager::total_matches() const {
+  uint64_t total = 0;
+  for (auto &worker : workers)
+    total += worker->matches.load(std::memory_order_relaxed);
+  return total;
+}
+
+void BookManager::run(uint32_t index) {
+  Worker &worker = *workers[index];
+  uint64_t processed = 0;
+  uint64_t matches = 0;
+  BookCommand batch[kIngressBatch];
+  for (;;) {
+    if (size_t n = worker.queue.try_pop_batch(batch, kIngressBatch)) {
+      for (size_t i = 0; i < n; ++i)
+        matches += apply_command(*books[batch[i].symbol], batch[i].command);
+      processed += n;
+      // Only this thread writes the counters, so plain stores suffice
+      worker.matches.store(matches, std::memory_order_relaxed);
+      worker.processed.store(processed, std::memory_order_release);
+    } else if (!running.load(std::memory_order_acquire)) {
+      // Anything queued before shutdown was requested is visible by now
+      if (worker.queue.empty())
+        return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "engine.hpp"
+#include "order_ingress.hpp"
+#include "spsc_queue.hpp"
+
+using SymbolId = uint32_t;
+
+// An ingress command addressed to one symbol's book
+struct BookCommand {
+  SymbolId symbol;
+  OrderCommand command;
+};
+
+// Owns one Orderbook per symbol and shards symbols across worker threads.
+// Symbol s belongs to worker s % workerCount, which is the only thread that
+// ever touches its book, so matching stays single-threaded per book with no
+// locking. Each worker drains its own single-producer/single-consumer queue
+// in batches and is pinned to its own core where the platform allows.
+//
+// Commands must be submitted from a single thread. Books may only be read
+// directly once wait_idle has returned.
+class BookManager {
+public:
+  BookManager(uint32_t symbolCount, uint32_t workerCount,
+              uint32_t queueCapacity = 1u << 16,
+              uint32_t orderCapacity = OrderPool::kDefaultCapacity);
+  ~BookManager();
+
+  BookManager(const BookManager &) = delete;
+  BookManager &operator=(const BookManager &) = delete;
+
+  // Returns false if the owning worker's queue is full. Throws
+  // std::out_of_range for a symbol the manager has no book for
+  bool try_submit(const BookCommand &command);
+  // Spins until the command is queued
+  void submit(const BookCommand &command);
+  // Blocks until every submitted command has been processed
+  void wait_idle();
+
+  uint32_t worker_for(SymbolId symbol) const { return symbol % workers.size(); }
+  // Throws std::out_of_range for an unknown symbol
+  Orderbook &book(SymbolId symbol) { return *books.at(symbol); }
+  // Total matches reported by match_order across all books
+  uint64_t total_matches() const;
+
+private:
+  struct Worker {
+    explicit Worker(uint32_t queueCapacity) : queue(queueCapacity) {}
+    SpscQueue<BookCommand> queue;
+    uint64_t submitted = 0; // producer thread only
+    std::atomic<uint64_t> processed{0};
+    std::atomic<uint64_t> matches{0};
+    std::thread thread;
+  };
+
+  void run(uint32_t index);
+
+  std::vector<std::unique_ptr<Orderbook>> books;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> running{true};
+};
@@ -1,173 +1,1149 @@
 #include "engine.hpp"
-#include <functional>
-#include <optional>
+#include "journal.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
 #include <stdexcept>
-#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
 
-// This is an example correct implementation
-// It is INTENTIONALLY suboptimal
-// You are encouraged to rewrite as much or as little as you'd like
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Templated helper to process matching orders.
-// The Condition predicate takes the price level and the incoming order price
-// and returns whether the level qualifies.
-template <typename OrderMap, typename Condition>
-uint32_t process_orders(const Order &order, OrderMap &ordersMap, Condition cond, QuantityType& orderQuantity) {
-  uint32_t matchCount = 0;
-  auto it = ordersMap.begin();
-  while (it != ordersMap.end() && order.quantity > 0 && cond(it->first, order.price)) {
-    auto &ordersAtPrice = it->second;
-    auto& ordersList = ordersAtPrice.orders;
-    for (long unsigned int index = ordersAtPrice.index ;index < ordersList.size() && orderQuantity > 0;index++) {
-      auto currOrder = ordersList[index];
-      QuantityType trade = std::min(orderQuantity, currOrder->quantity);
+// Next live bid strictly below price, or -1 if there is none
+static inline int32_t next_bid(const PriceBitmap &occupied, int32_t price) {
+  return occupied.next_at_or_below(price - 1);
+}
+
+// Next live ask strictly above price, or kPriceLevels if there is none
+static inline int32_t next_ask(const PriceBitmap &occupied, int32_t price) {
+  return occupied.next_at_or_above(price + 1);
+}
+
+// Everything that differs between the two sides of the book, resolved at
+// compile time. Prices are compared through better(), so code written once
+// against BookSide<S> becomes the bid or the ask version with no runtime
+// branch on the side
+template <Side S> struct BookSide;
+
+template <> struct BookSide<Side::BUY> {
+  static constexpr Side kOpposite = Side::SELL;
+  // Least aggressive price on the ladder
+  static constexpr int32_t kWorst = 0;
+  static PriceLevel *levels(const Orderbook &orderbook) {
+    return orderbook.buyOrders;
+  }
+  static PriceBitmap &occupied(const Orderbook &orderbook) {
+    return *orderbook.buyLevels;
+  }
+  static int32_t &best(Orderbook &orderbook) { return orderbook.bestBid; }
+  static int32_t best(const Orderbook &orderbook) { return orderbook.bestBid; }
+  static VolumeTree *volume(const Orderbook &orderbook) {
+    return orderbook.buyVolume;
+  }
+  // Whether price a is strictly more aggressive than price b
+  static bool better(int32_t a, int32_t b) { return a > b; }
+  // Next live level behind price, away from the touch
+  static int32_t behind(const PriceBitmap &occupied, int32_t price) {
+    return next_bid(occupied, price);
+  }
+  // Volume from the touch through price inclusive
+  static uint64_t volume_through(const VolumeTree &tree, int32_t price) {
+    return tree.total() - tree.prefix(price);
+  }
+  // Least aggressive price a sweep of quantity reaches, given that the side
+  // holds at least quantity > 0
+  static int32_t price_for(const VolumeTree &tree, uint64_t quantity) {
+    return tree.max_count_within(tree.total() - quantity);
+  }
+};
+
+template <> struct BookSide<Side::SELL> {
+  static constexpr Side kOpposite = Side::BUY;
+  static constexpr int32_t kWorst = kPriceLevels - 1;
+  static PriceLevel *levels(const Orderbook &orderbook) {
+    return orderbook.sellOrders;
+  }
+  static PriceBitmap &occupied(const Orderbook &orderbook) {
+    return *orderbook.sellLevels;
+  }
+  static int32_t &best(Orderbook &orderbook) { return orderbook.bestAsk; }
+  static int32_t best(const Orderbook &orderbook) { return orderbook.bestAsk; }
+  static VolumeTree *volume(const Orderbook &orderbook) {
+    return orderbook.sellVolume;
+  }
+  static bool better(int32_t a, int32_t b) { return a < b; }
+  static int32_t behind(const PriceBitmap &occupied, int32_t price) {
+    return next_ask(occupied, price);
+  }
+  static uint64_t volume_through(const VolumeTree &tree, int32_t price) {
+    return tree.prefix(price + 1);
+  }
+  static int32_t price_for(const VolumeTree &tree, uint64_t quantity) {
+    return tree.max_count_within(quantity - 1);
+  }
+};
+
+// Visits the live levels of side S from the touch through limit inclusive,
+// in the order matching reaches them, for as long as f returns true. Every
+// read-only walk of the book goes through here
+template <Side S, typename F>
+static inline void walk_levels(const Orderbook &orderbook, int32_t limit,
+                               F f) {
+  using Book = BookSide<S>;
+  const PriceLevel *levels = Book::levels(orderbook);
+  const PriceBitmap &occupied = Book::occupied(orderbook);
+  for (int32_t price = Book::best(orderbook); !Book::better(limit, price);
+       price = Book::behind(occupied, price))
+    if (!f((PriceType)price, levels[price]))
+      return;
+}
+
+// Links a node onto the tail of a level's FIFO
+static inline void append_order(OrderPool &pool, PriceLevel &level,
+                                NodeIndex idx) {
+  pool.prev(idx) = level.tail;
+  pool.next(idx) = kNullNode;
+  if (level.tail != kNullNode)
+    pool.next(level.tail) = idx;
+  else
+    level.head = idx;
+  level.tail = idx;
+  ++level.count;
+}
+
+// Unlinks a node from anywhere in its level's FIFO in O(1)
+static inline void unlink_order(OrderPool &pool, PriceLevel &level,
+                                NodeIndex idx) {
+  NodeIndex prev = pool.prev(idx);
+  NodeIndex next = pool.next(idx);
+  if (prev != kNullNode)
+    pool.next(prev) = next;
+  else
+    level.head = next;
+  if (next != kNullNode)
+    pool.prev(next) = prev;
+  else
+    level.tail = prev;
+  --level.count;
+}
+
+// Optional parts of the matching path. They are fixed per instantiation so a
+// book without sinks attached, self-trade prevention set or a volume index
+// runs with them compiled out
+constexpr unsigned kRecordFills = 1;
+constexpr unsigned kRecordDepth = 2;
+constexpr unsigned kPreventSelfTrade = 4;
+constexpr unsigned kTrackVolume = 8;
+
+template <unsigned Features>
+static inline void record_depth(Orderbook &orderbook, Side side,
+                                PriceType price, uint32_t volume) {
+  if constexpr ((Features & kRecordDepth) != 0)
+    orderbook.depth.push({side, price, volume});
+}
+
+// Applies a level's net volume change to the side's volume index
+template <unsigned Features, Side S>
+static inline void record_volume(Orderbook &orderbook, PriceType price,
+                                 int64_t delta) {
+  if constexpr ((Features & kTrackVolume) != 0)
+    BookSide<S>::volume(orderbook)->add(price, delta);
+}
+
+// Records how far the id index probed for id. The extra lookup only exists in
+// instrumented builds
+static inline void record_probe(Orderbook &orderbook, IdType id) {
+  if constexpr (kInstrumented)
+    orderbook.stats.indexProbes.record(orderbook.orders.probe_length(id));
+}
+
+// Records the shape of one call's walk through the book
+static inline uint32_t finish_match(Orderbook &orderbook, uint32_t levels,
+                                    uint32_t matchCount) {
+  instrument_record(orderbook.stats.levelsPerMatch, levels);
+  instrument_record(orderbook.stats.ordersPerMatch, matchCount);
+  return matchCount;
+}
+
+// Applies the book's self-trade policy to the head of level, which belongs to
+// the incoming order's own owner. Whatever is taken off the resting order is
+// cancelled rather than filled, and the order leaves the level if nothing of
+// it remains
+static void prevent_self_trade(Orderbook &orderbook, PriceLevel &level,
+                               NodeIndex head, QuantityType &orderQuantity) {
+  auto &pool = orderbook.pool;
+  QuantityType &restingQuantity = pool.quantity(head);
+  QuantityType cancelled;
+  switch (orderbook.stp) {
+  case StpPolicy::CANCEL_OLDEST:
+    cancelled = restingQuantity;
+    break;
+  case StpPolicy::DECREMENT_BOTH:
+    cancelled = std::min(orderQuantity, restingQuantity);
+    orderQuantity -= cancelled;
+    break;
+  default: // CANCEL_NEWEST
+    orderQuantity = 0;
+    return;
+  }
+  restingQuantity -= cancelled;
+  level.volume -= cancelled;
+  if (restingQuantity != 0)
+    return;
+  NodeIndex nextNode = pool.next(head);
+  orderbook.orders.erase(pool.id(head));
+  --level.count;
+  pool.release(head);
+  level.head = nextNode;
+  if (nextNode != kNullNode)
+    pool.prev(nextNode) = kNullNode;
+}
+
+// The fill rule of the matching path, written once so that matching and
+// simulation cannot disagree. Levels of the resting side are visited best
+// first for as long as the touch is at or inside limit and quantity remains.
+// An empty side's best price sits one step past the end of the ladder, which
+// never passes that test, so no separate emptiness check is needed. Within a
+// level resting orders are filled from the head, each taking as much of the
+// incoming quantity as it holds, until the incoming order runs out; the last
+// one may be filled only partly.
+//
+// Walk decides what a fill does, through these members:
+//   best()                touch price the walk starts from
+//   enter(price)          starts the level at price
+//   head()                next resting order to fill there, or kNullNode
+//   quantity(idx)         what resting order idx holds
+//   self_trade(idx, qty)  true if self-trade prevention dealt with idx
+//   fill(idx, trade, whole)  fills trade of idx; whole if that uses it up
+//   leave()               ends the level and returns the next price to visit
+//
+// Resting orders are filled one at a time. Gathering the next eight
+// quantities and counting full fills with an AVX2 prefix sum was tried and
+// lost on the aggressive sweeps bench (9.8-13.0 against 13.0-20.7 Mops/s):
+// the gather chases links past where the order runs out, and the index
+// erase and node release per fill cost far more than the compare it saves.
+template <Side Resting, typename Walk>
+static inline void sweep_levels(Walk &walk, PriceType limit,
+                                QuantityType &orderQuantity) {
+  using Book = BookSide<Resting>;
+  for (int32_t price = walk.best();
+       orderQuantity > 0 && !Book::better(limit, price); price = walk.leave()) {
+    walk.enter(price);
+    for (NodeIndex head = walk.head(); head != kNullNode && orderQuantity > 0;
+         head = walk.head()) {
+      if (walk.self_trade(head, orderQuantity))
+        continue;
+      QuantityType resting = walk.quantity(head);
+      QuantityType trade = std::min(orderQuantity, resting);
       orderQuantity -= trade;
-      currOrder->quantity -= trade;
-      ++matchCount;
-      if (currOrder->quantity == 0)
-        ordersAtPrice.index++;
-      else{
-        return matchCount;
-      }
+      walk.fill(head, trade, trade == resting);
     }
-    if (ordersAtPrice.index==ordersList.size()) //ordersAtPrice.empty())
-      it = ordersMap.erase(it);
-    else
-      break;
   }
-  return matchCount;
 }
 
-uint32_t match_order(Orderbook &orderbook, const Order &incoming) {
+// Matching's Walk. Fills come off the resting orders, used up orders leave
+// the book, and a level the walk empties is retired. Each level produces at
+// most one depth update and one volume index update, when the walk leaves
+// it, and none if its volume did not change. With self-trade prevention
+// every resting order is first checked against the incoming owner
+template <unsigned Features, Side Resting> struct MatchWalk {
+  using Book = BookSide<Resting>;
+
+  Orderbook &orderbook;
+  const Order &order;
+  OwnerId owner;
+  PriceLevel *level = nullptr;
+  PriceType price = 0;
+  uint32_t volumeBefore = 0;
   uint32_t matchCount = 0;
-  QuantityType quantity= incoming.quantity;
-   // Create a copy to modify the quantity
-
-  if (incoming.side == Side::BUY) {
-    // For a BUY, match with sell orders priced at or below the order's price.
-    matchCount = process_orders(incoming, orderbook.sellOrders, std::less_equal<>(), quantity);
-    if (quantity > 0){
-      auto order = std::make_shared<Order>(incoming);
-      order->quantity = quantity;
-      orderbook.buyOrders[order->price].orders.push_back(order);
-      orderbook.orders[order->id] = order;
+  uint32_t levelsWalked = 0;
+
+  int32_t best() const { return Book::best(orderbook); }
+
+  void enter(int32_t at) {
+    ++levelsWalked;
+    level = &Book::levels(orderbook)[at];
+    price = (PriceType)at;
+    volumeBefore = level->volume;
+  }
+
+  NodeIndex head() const { return level->head; }
+
+  QuantityType quantity(NodeIndex idx) const {
+    return orderbook.pool.quantity(idx);
+  }
+
+  bool self_trade(NodeIndex idx, QuantityType &orderQuantity) {
+    if constexpr ((Features & kPreventSelfTrade) != 0) {
+      if (owner != kNoOwner && orderbook.pool.owner(idx) == owner) {
+        prevent_self_trade(orderbook, *level, idx, orderQuantity);
+        return true;
+      }
+    }
+    return false;
+  }
 
+  void fill(NodeIndex idx, QuantityType trade, bool whole) {
+    auto &pool = orderbook.pool;
+    IdType restingId = pool.id(idx);
+    level->volume -= trade;
+    ++matchCount;
+    if constexpr ((Features & kRecordFills) != 0)
+      orderbook.fills.push({restingId, order.id, price, trade});
+    if (!whole) {
+      pool.quantity(idx) -= trade;
+      return;
     }
-  } 
-  else { // Side::SELL
-    // For a SELL, match with buy orders priced at or above the order's price.
-    matchCount = process_orders(incoming, orderbook.buyOrders, std::greater_equal<>(), quantity);
-    if (quantity > 0){
-      auto order = std::make_shared<Order>(incoming);
-      order->quantity = quantity;
-      orderbook.sellOrders[order->price].orders.push_back(order);
-      orderbook.orders[order->id] = order;
+    // Filled: pop it off the level and hand the node back to the pool
+    NodeIndex nextNode = pool.next(idx);
+    level->head = nextNode;
+    if (nextNode != kNullNode)
+      pool.prev(nextNode) = kNullNode;
+    --level->count;
+    orderbook.orders.erase(restingId);
+    pool.release(idx);
+  }
+
+  int32_t leave() {
+    // CANCEL_NEWEST can stop at the head without changing the level at all
+    if (level->volume != volumeBefore) {
+      record_depth<Features>(orderbook, Resting, price, level->volume);
+      record_volume<Features, Resting>(orderbook, price,
+                                       (int64_t)level->volume - volumeBefore);
     }
-      
+    int32_t &bestPrice = Book::best(orderbook);
+    if (level->head != kNullNode)
+      return bestPrice;
+    level->tail = kNullNode;
+    auto &occupied = Book::occupied(orderbook);
+    occupied.clear(bestPrice);
+    bestPrice = Book::behind(occupied, bestPrice);
+    return bestPrice;
+  }
+};
+
+// Matches an incoming order against the resting side Resting
+template <unsigned Features, Side Resting>
+static uint32_t process_orders(const Order &order, Orderbook &orderbook,
+                               QuantityType &orderQuantity, OwnerId owner) {
+  MatchWalk<Features, Resting> walk{orderbook, order, owner};
+  sweep_levels<Resting>(walk, order.price, orderQuantity);
+  return finish_match(orderbook, walk.levelsWalked, walk.matchCount);
+}
+
+// Puts the unfilled remainder of an incoming order on its own side of the book
+template <unsigned Features, Side S>
+static void rest_order(Orderbook &orderbook, const Order &incoming,
+                       QuantityType quantity, OwnerId owner) {
+  using Book = BookSide<S>;
+  NodeIndex idx = orderbook.pool.allocate();
+  instrument_count(orderbook.stats.allocations);
+  Order order = incoming;
+  order.quantity = quantity;
+  orderbook.pool.store(idx, order);
+  if constexpr ((Features & kPreventSelfTrade) != 0)
+    orderbook.pool.owner(idx) = owner;
+  auto &level = Book::levels(orderbook)[order.price];
+  append_order(orderbook.pool, level, idx);
+  level.volume += quantity;
+  record_depth<Features>(orderbook, S, order.price, level.volume);
+  record_volume<Features, S>(orderbook, order.price, quantity);
+  Book::occupied(orderbook).set(order.price);
+  orderbook.orders.insert(order.id, idx);
+  record_probe(orderbook, order.id);
+  int32_t &best = Book::best(orderbook);
+  if (Book::better(order.price, best))
+    best = order.price;
+}
+
+// FOK check for an order tagged with owner under a self-trade policy. Only
+// other owners' orders count towards quantity, visited in the order matching
+// reaches them. CANCEL_OLDEST cancels the owner's own orders and walks past
+// them; under the other policies the first own order would stop or shrink the
+// incoming order, so nothing behind it counts
+template <Side Resting>
+static bool can_fill_excluding(const Orderbook &orderbook, PriceType limit,
+                               QuantityType quantity, OwnerId owner) {
+  const auto &pool = orderbook.pool;
+  bool skipOwn = orderbook.stp == StpPolicy::CANCEL_OLDEST;
+  uint32_t available = 0;
+  walk_levels<Resting>(orderbook, limit,
+                       [&](PriceType, const PriceLevel &level) {
+                         for (NodeIndex i = level.head; i != kNullNode;
+                              i = pool.next(i)) {
+                           if (pool.owner(i) == owner) {
+                             if (!skipOwn)
+                               return false;
+                             continue;
+                           }
+                           available += pool.quantity(i);
+                           if (available >= quantity)
+                             return false;
+                         }
+                         return true;
+                       });
+  return available >= quantity;
+}
+
+// Whether the resting side Resting holds at least quantity at or inside
+// limit that the incoming order may trade with. With a volume index that is
+// one prefix sum; otherwise only level aggregates are read, walking live
+// levels through the bitmap and stopping as soon as enough has been seen. A
+// tagged order under a self-trade policy has to look at individual orders
+template <unsigned Features, Side Resting>
+static bool can_fill(Orderbook &orderbook, PriceType limit,
+                     QuantityType quantity, OwnerId owner) {
+  using Book = BookSide<Resting>;
+  if constexpr ((Features & kPreventSelfTrade) != 0) {
+    if (owner != kNoOwner)
+      return can_fill_excluding<Resting>(orderbook, limit, quantity, owner);
+  }
+  if constexpr ((Features & kTrackVolume) != 0)
+    return Book::volume_through(*Book::volume(orderbook), limit) >= quantity;
+  uint32_t available = 0;
+  walk_levels<Resting>(orderbook, limit,
+                       [&](PriceType, const PriceLevel &level) {
+                         available += level.volume;
+                         return available < quantity;
+                       });
+  return available >= quantity;
+}
+
+template <unsigned Features, TimeInForce Tif, Side S>
+static uint32_t match_order_impl(Orderbook &orderbook, const Order &incoming,
+                                 OwnerId owner) {
+  constexpr Side kResting = BookSide<S>::kOpposite;
+  if constexpr (Tif == TimeInForce::FOK) {
+    if (!can_fill<Features, kResting>(orderbook, incoming.price,
+                                      incoming.quantity, owner))
+      return 0;
+  }
+  if constexpr (Tif == TimeInForce::POST_ONLY) {
+    if (!BookSide<kResting>::better(incoming.price,
+                                    BookSide<kResting>::best(orderbook)))
+      return 0;
+  }
+  // Matching works on a copy of the quantity; only the remainder rests
+  QuantityType quantity = incoming.quantity;
+  uint32_t matchCount =
+      process_orders<Features, kResting>(incoming, orderbook, quantity, owner);
+  if constexpr (Tif == TimeInForce::GTC || Tif == TimeInForce::POST_ONLY) {
+    if (quantity > 0)
+      rest_order<Features, S>(orderbook, incoming, quantity, owner);
   }
   return matchCount;
 }
 
-// Templated helper to cancel an order within a given orders map.
-template <typename OrderMap>
-bool modify_order_in_map(OrderMap &ordersMap, IdType order_id,
-                         QuantityType new_quantity) {
-
-
-  for (auto it = ordersMap.begin(); it != ordersMap.end();) {
-    auto &priceLevel = it->second;
-    auto& ordersList = priceLevel.orders;
-    for (unsigned long index = priceLevel.index; index<ordersList.size(); index++) {
-      auto currOrder = ordersList[index];
-      if (currOrder->id == order_id) {
-        if (new_quantity == 0){
-          priceLevel.index++;
-          return true;
-        }
-        else {
-          currOrder->quantity = new_quantity;
-          return true;
-        }
-      } 
-    }
-    if (priceLevel.index>ordersList.size())
-      it = ordersMap.erase(it);
-    else
-      ++it;
+// simulate_match's Walk. It only reads the book, following the same resting
+// orders matching would fill, and tallies the fills per level into result.
+// Simulated orders are untagged, so there is nothing to prevent
+template <Side Resting> struct SimWalk {
+  using Book = BookSide<Resting>;
+
+  const Orderbook &orderbook;
+  SimResult &result;
+  NodeIndex cursor = kNullNode;
+  SimLevel level = {};
+
+  int32_t best() const { return Book::best(orderbook); }
+
+  void enter(int32_t at) {
+    cursor = Book::levels(orderbook)[at].head;
+    level = {(PriceType)at, 0, 0};
   }
-  return false;
+
+  NodeIndex head() const { return cursor; }
+
+  QuantityType quantity(NodeIndex idx) const {
+    return orderbook.pool.quantity(idx);
+  }
+
+  bool self_trade(NodeIndex, QuantityType &) const { return false; }
+
+  void fill(NodeIndex idx, QuantityType trade, bool whole) {
+    level.quantity += trade;
+    ++level.orders;
+    if (whole)
+      cursor = orderbook.pool.next(idx);
+  }
+
+  int32_t leave() {
+    if (result.levels && result.levelCount < result.levelCapacity)
+      result.levels[result.levelCount] = level;
+    ++result.levelCount;
+    result.matchCount += level.orders;
+    result.filledQuantity += level.quantity;
+    result.notional += (uint64_t)level.price * level.quantity;
+    return Book::behind(Book::occupied(orderbook), level.price);
+  }
+};
+
+// Read-only counterpart of process_orders for an untagged order
+template <Side Resting>
+static uint32_t simulate_orders(const Orderbook &orderbook, const Order &order,
+                                QuantityType &orderQuantity,
+                                SimResult &result) {
+  SimWalk<Resting> walk{orderbook, result};
+  sweep_levels<Resting>(walk, order.price, orderQuantity);
+  return result.matchCount;
+}
+
+// Mirrors match_order_impl's time in force handling around simulate_orders.
+// Without an owner a FOK check passes exactly when the walk fills the whole
+// order, so FOK is simulated by discarding a walk that falls short
+template <Side S>
+static uint32_t simulate_match_impl(const Orderbook &orderbook,
+                                    const Order &incoming, TimeInForce tif,
+                                    SimResult &result) {
+  constexpr Side kResting = BookSide<S>::kOpposite;
+  result.levelCount = 0;
+  result.matchCount = 0;
+  result.filledQuantity = 0;
+  result.notional = 0;
+  result.averagePrice = 0;
+  result.restingQuantity = 0;
+  if (tif == TimeInForce::POST_ONLY &&
+      !BookSide<kResting>::better(incoming.price,
+                                  BookSide<kResting>::best(orderbook)))
+    return 0;
+  QuantityType quantity = incoming.quantity;
+  if (quantity > 0)
+    simulate_orders<kResting>(orderbook, incoming, quantity, result);
+  if (tif == TimeInForce::FOK && quantity > 0) {
+    result.levelCount = 0;
+    result.matchCount = 0;
+    result.filledQuantity = 0;
+    result.notional = 0;
+    return 0;
+  }
+  if (tif == TimeInForce::GTC || tif == TimeInForce::POST_ONLY)
+    result.restingQuantity = quantity;
+  if (result.filledQuantity)
+    result.averagePrice = (double)result.notional / result.filledQuantity;
+  return result.matchCount;
+}
+
+using MatchKernel = uint32_t (*)(Orderbook &, const Order &, OwnerId);
+
+constexpr size_t kFeatureMasks = 16;
+constexpr size_t kTimeInForces = 4;
+
+// Every specialization of the matching path in one flat table, indexed by
+// time in force, then feature mask, then incoming side, so a call dispatches
+// exactly once
+static constexpr size_t kernel_index(TimeInForce tif, unsigned features,
+                                     Side side) {
+  return ((size_t)tif * kFeatureMasks + features) * 2 + (size_t)side;
+}
+
+template <size_t... I>
+static constexpr std::array<MatchKernel, sizeof...(I)>
+make_match_kernels(std::index_sequence<I...>) {
+  return {{&match_order_impl<(unsigned)(I / 2 % kFeatureMasks),
+                             (TimeInForce)(I / 2 / kFeatureMasks),
+                             (Side)(I % 2)>...}};
+}
+
+static constexpr auto kMatchKernels = make_match_kernels(
+    std::make_index_sequence<kTimeInForces * kFeatureMasks * 2>());
+
+static uint32_t run_match(Orderbook &orderbook, const Order &incoming,
+                          TimeInForce tif, OwnerId owner) {
+  unsigned features =
+      (orderbook.fills.buffer ? kRecordFills : 0) |
+      (orderbook.depth.buffer ? kRecordDepth : 0) |
+      (orderbook.stp != StpPolicy::NONE ? kPreventSelfTrade : 0) |
+      (orderbook.buyVolume ? kTrackVolume : 0);
+  return kMatchKernels[kernel_index(tif, features, incoming.side)](
+      orderbook, incoming, owner);
+}
+
+static uint32_t dispatch_match(Orderbook &orderbook, const Order &incoming,
+                               TimeInForce tif, OwnerId owner) {
+  CycleTimer timer(orderbook.stats.matchCycles);
+  if (orderbook.journal)
+    orderbook.journal->append(OrderCommand::Type::NEW, incoming.id,
+                              incoming.price, incoming.quantity, incoming.side,
+                              tif, owner);
+  return run_match(orderbook, incoming, tif, owner);
+}
+
+uint32_t match_order(Orderbook &orderbook, const Order &incoming) {
+  return dispatch_match(orderbook, incoming, TimeInForce::GTC, kNoOwner);
+}
+
+uint32_t match_order_with_tif(Orderbook &orderbook, const Order &incoming,
+                              TimeInForce tif) {
+  if ((size_t)tif >= kTimeInForces)
+    throw std::invalid_argument("Unknown time in force");
+  return dispatch_match(orderbook, incoming, tif, kNoOwner);
+}
+
+uint32_t match_order_as(Orderbook &orderbook, const Order &incoming,
+                        TimeInForce tif, OwnerId owner) {
+  if ((size_t)tif >= kTimeInForces)
+    throw std::invalid_argument("Unknown time in force");
+  return dispatch_match(orderbook, incoming, tif, owner);
+}
+
+uint32_t simulate_match(const Orderbook &orderbook, const Order &incoming,
+                        SimResult *result) {
+  return simulate_match_with_tif(orderbook, incoming, TimeInForce::GTC, result);
+}
+
+uint32_t simulate_match_with_tif(const Orderbook &orderbook,
+                                 const Order &incoming, TimeInForce tif,
+                                 SimResult *result) {
+  if ((size_t)tif >= kTimeInForces)
+    throw std::invalid_argument("Unknown time in force");
+  return incoming.side == Side::BUY
+             ? simulate_match_impl<Side::BUY>(orderbook, incoming, tif, *result)
+             : simulate_match_impl<Side::SELL>(orderbook, incoming, tif,
+                                               *result);
+}
+
+void set_self_trade_policy(Orderbook &orderbook, StpPolicy policy) {
+  if ((size_t)policy > (size_t)StpPolicy::DECREMENT_BOTH)
+    throw std::invalid_argument("Unknown self-trade policy");
+  if (orderbook.journal)
+    orderbook.journal->append(OrderCommand::Type::STP_POLICY, 0, 0,
+                              (QuantityType)policy, Side::BUY);
+  if (orderbook.stp == StpPolicy::NONE && policy != StpPolicy::NONE)
+    orderbook.pool.enable_owners();
+  orderbook.stp = policy;
+}
+
+// Physically removes a resting order: unlinks it from its level, frees its
+// node and id entry, and retires the level if it is now empty
+template <Side S>
+static void remove_order(Orderbook &orderbook, NodeIndex idx) {
+  using Book = BookSide<S>;
+  auto &pool = orderbook.pool;
+  PriceType price = pool.price(idx);
+  auto &level = Book::levels(orderbook)[price];
+  unlink_order(pool, level, idx);
+  level.volume -= pool.quantity(idx);
+  if (orderbook.depth.buffer)
+    orderbook.depth.push({S, price, level.volume});
+  if (VolumeTree *tree = Book::volume(orderbook))
+    tree->add(price, -(int64_t)pool.quantity(idx));
+  if (level.head == kNullNode) {
+    auto &occupied = Book::occupied(orderbook);
+    occupied.clear(price);
+    int32_t &best = Book::best(orderbook);
+    if (price == best)
+      best = Book::behind(occupied, price);
+  }
+  orderbook.orders.erase(pool.id(idx));
+  pool.release(idx);
+}
+
+static void remove_order(Orderbook &orderbook, NodeIndex idx) {
+  if (orderbook.pool.side(idx) == Side::BUY)
+    remove_order<Side::BUY>(orderbook, idx);
+  else
+    remove_order<Side::SELL>(orderbook, idx);
+}
+
+// Changes a resting order's quantity with exchange priority rules: a reduce
+// keeps the order's place in the queue, an increase sends it to the back
+template <Side S>
+static void change_quantity(Orderbook &orderbook, NodeIndex idx,
+                            QuantityType new_quantity) {
+  auto &pool = orderbook.pool;
+  QuantityType &quantity = pool.quantity(idx);
+  if (new_quantity == quantity)
+    return;
+  PriceType price = pool.price(idx);
+  auto &level = BookSide<S>::levels(orderbook)[price];
+  level.volume = level.volume - quantity + new_quantity;
+  if (new_quantity > quantity && level.tail != idx) {
+    unlink_order(pool, level, idx);
+    append_order(pool, level, idx);
+  }
+  if (VolumeTree *tree = BookSide<S>::volume(orderbook))
+    tree->add(price, (int64_t)new_quantity - quantity);
+  quantity = new_quantity;
+  if (orderbook.depth.buffer)
+    orderbook.depth.push({S, price, level.volume});
 }
 
 void modify_order_by_id(Orderbook &orderbook, IdType order_id,
                         QuantityType new_quantity) {
+  CycleTimer timer(orderbook.stats.modifyCycles);
+  if (orderbook.journal)
+    orderbook.journal->append(OrderCommand::Type::MODIFY, order_id, 0,
+                              new_quantity, Side::BUY);
+  NodeIndex idx = orderbook.orders.find(order_id);
+  record_probe(orderbook, order_id);
+  if (idx == kNullNode)
+    return;
+  if (new_quantity == 0) {
+    remove_order(orderbook, idx);
+    return;
+  }
+  if (orderbook.pool.side(idx) == Side::BUY)
+    change_quantity<Side::BUY>(orderbook, idx, new_quantity);
+  else
+    change_quantity<Side::SELL>(orderbook, idx, new_quantity);
+}
 
-  // might have to check for existence
-  if (orderbook.orders.find(order_id)!= orderbook.orders.end()){
-    orderbook.orders[order_id]->quantity = new_quantity;
+uint32_t replace_order(Orderbook &orderbook, IdType order_id,
+                       PriceType new_price, QuantityType new_quantity) {
+  CycleTimer timer(orderbook.stats.modifyCycles);
+  if (orderbook.journal)
+    orderbook.journal->append(OrderCommand::Type::REPLACE, order_id, new_price,
+                              new_quantity, Side::BUY);
+  NodeIndex idx = orderbook.orders.find(order_id);
+  record_probe(orderbook, order_id);
+  if (idx == kNullNode)
+    return 0;
+  Order replacement = orderbook.pool.order(idx);
+  if (new_quantity != 0 && new_price == replacement.price) {
+    if (replacement.side == Side::BUY)
+      change_quantity<Side::BUY>(orderbook, idx, new_quantity);
+    else
+      change_quantity<Side::SELL>(orderbook, idx, new_quantity);
+    return 0;
   }
-  // if (modify_order_in_map(orderbook.buyOrders, order_id, new_quantity))
-  //   return;
-  // if (modify_order_in_map(orderbook.sellOrders, order_id, new_quantity))
-  //   return;
+  OwnerId owner =
+      orderbook.stp != StpPolicy::NONE ? orderbook.pool.owner(idx) : kNoOwner;
+  remove_order(orderbook, idx);
+  if (new_quantity == 0)
+    return 0;
+  replacement.price = new_price;
+  replacement.quantity = new_quantity;
+  return run_match(orderbook, replacement, TimeInForce::GTC, owner);
 }
 
-template <typename OrderMap>
-std::optional<Order> lookup_order_in_map(OrderMap &ordersMap, IdType order_id) {
-  for (const auto &[price, priceLevel] : ordersMap) {
-    auto& ordersList = priceLevel.orders;
-    auto& index = priceLevel.index;
-    for (unsigned long i = index; i<ordersList.size(); i++) {
-      if (ordersList[i].id== order_id) {
-        return ordersList[i];
-      }
+bool cancel_order_by_id(Orderbook &orderbook, IdType order_id) {
+  if (orderbook.journal)
+    orderbook.journal->append(OrderCommand::Type::CANCEL, order_id, 0, 0,
+                              Side::BUY);
+  NodeIndex idx = orderbook.orders.find(order_id);
+  record_probe(orderbook, order_id);
+  if (idx == kNullNode)
+    return false;
+  remove_order(orderbook, idx);
+  return true;
+}
+
+// How many elements ahead the batch calls prefetch. Far enough to hide a
+// miss to memory behind the work on the current order, near enough that the
+// lines are still in cache when their turn comes
+constexpr size_t kPrefetchDistance = 4;
+
+// Touches everything an incoming order is likely to need up front: its own
+// side's level (where a remainder rests), the opposite touch it matches
+// against and the id-index slot an insert would probe first
+static inline void prefetch_order(const Orderbook &orderbook,
+                                  const Order &order) {
+  if (order.side == Side::BUY) {
+    __builtin_prefetch(&orderbook.buyOrders[order.price], 1);
+    if (orderbook.bestAsk < (int32_t)kPriceLevels)
+      __builtin_prefetch(&orderbook.sellOrders[orderbook.bestAsk], 1);
+  } else {
+    __builtin_prefetch(&orderbook.sellOrders[order.price], 1);
+    if (orderbook.bestBid >= 0)
+      __builtin_prefetch(&orderbook.buyOrders[orderbook.bestBid], 1);
+  }
+  __builtin_prefetch(orderbook.orders.home_slot(order.id), 1);
+}
+
+void match_orders(Orderbook &orderbook, const Order *orders, size_t count,
+                  uint32_t *matches_out) {
+  for (size_t i = 0; i < count && i < kPrefetchDistance; ++i)
+    prefetch_order(orderbook, orders[i]);
+  for (size_t i = 0; i < count; ++i) {
+    if (i + kPrefetchDistance < count)
+      prefetch_order(orderbook, orders[i + kPrefetchDistance]);
+    matches_out[i] = match_order(orderbook, orders[i]);
+  }
+}
+
+void modify_orders_by_id(Orderbook &orderbook, const IdType *order_ids,
+                         const QuantityType *new_quantities, size_t count) {
+  for (size_t i = 0; i < count && i < kPrefetchDistance; ++i)
+    __builtin_prefetch(orderbook.orders.home_slot(order_ids[i]));
+  for (size_t i = 0; i < count; ++i) {
+    if (i + kPrefetchDistance < count)
+      __builtin_prefetch(
+          orderbook.orders.home_slot(order_ids[i + kPrefetchDistance]));
+    // The slot for the next id is warm by now, so its node can be fetched
+    // before the current modify runs
+    if (i + 1 < count) {
+      NodeIndex next = orderbook.orders.find(order_ids[i + 1]);
+      if (next != kNullNode)
+        __builtin_prefetch(&orderbook.pool.quantity(next), 1);
     }
+    modify_order_by_id(orderbook, order_ids[i], new_quantities[i]);
   }
-  return std::nullopt;
 }
 
-uint32_t get_volume_at_level(Orderbook &orderbook, Side side,
-                             PriceType quantity) {
-  uint32_t total = 0;
+void attach_fill_sink(Orderbook &orderbook, Fill *buffer, uint32_t capacity) {
+  if (buffer && (capacity == 0 || (capacity & (capacity - 1))))
+    throw std::invalid_argument("Fill sink capacity must be a power of two");
+  orderbook.fills.buffer = buffer;
+  orderbook.fills.mask = buffer ? capacity - 1 : 0;
+  orderbook.fills.written = 0;
+}
+
+uint64_t get_fill_count(Orderbook &orderbook) {
+  return orderbook.fills.written;
+}
+
+void attach_depth_sink(Orderbook &orderbook, DepthUpdate *buffer,
+                       uint32_t capacity) {
+  if (buffer && (capacity == 0 || (capacity & (capacity - 1))))
+    throw std::invalid_argument("Depth sink capacity must be a power of two");
+  orderbook.depth.buffer = buffer;
+  orderbook.depth.mask = buffer ? capacity - 1 : 0;
+  orderbook.depth.written = 0;
+}
+
+uint64_t get_depth_update_count(Orderbook &orderbook) {
+  return orderbook.depth.written;
+}
+
+uint32_t get_top_n_levels(Orderbook &orderbook, Side side, uint32_t n,
+                          DepthLevel *out) {
+  uint32_t count = 0;
   if (side == Side::BUY) {
-    auto buy_orders = orderbook.buyOrders.find(quantity);
-    if (buy_orders == orderbook.buyOrders.end()) {
-      return 0;
-    }
-    auto& priceLevel = buy_orders->second;
-    auto& orderList = priceLevel.orders;
-    for (unsigned long index = priceLevel.index; index<orderList.size(); index++) {
-      total += orderList[index]->quantity;
-    }
-  } else if (side == Side::SELL) {
-    auto sell_orders = orderbook.sellOrders.find(quantity);
-    if (sell_orders == orderbook.sellOrders.end()) {
-      return 0;
-    }
-    auto& priceLevel = sell_orders->second;
-    auto& orderList = priceLevel.orders;
-    for (unsigned long index = priceLevel.index; index<orderList.size(); index++) {
-      total += orderList[index]->quantity;
-    }
+    for (int32_t price = orderbook.bestBid; price >= 0 && count < n;
+         price = next_bid(*orderbook.buyLevels, price))
+      out[count++] = {(PriceType)price, orderbook.buyOrders[price].volume};
+  } else {
+    for (int32_t price = orderbook.bestAsk;
+         price < (int32_t)kPriceLevels && count < n;
+         price = next_ask(*orderbook.sellLevels, price))
+      out[count++] = {(PriceType)price, orderbook.sellOrders[price].volume};
   }
-  return total;
+  return count;
+}
+
+void attach_journal(Orderbook &orderbook, JournalWriter *journal) {
+  orderbook.journal = journal;
+  if (journal && orderbook.stp != StpPolicy::NONE)
+    journal->append(OrderCommand::Type::STP_POLICY, 0, 0,
+                    (QuantityType)orderbook.stp, Side::BUY);
+}
+
+uint32_t get_volume_at_level(Orderbook &orderbook, Side side,
+                             PriceType quantity) {
+  CycleTimer timer(orderbook.stats.volumeCycles);
+  return side == Side::BUY ? orderbook.buyOrders[quantity].volume
+                           : orderbook.sellOrders[quantity].volume;
+}
+
+bool instrumentation_enabled() { return kInstrumented; }
+
+void get_instrument_stats(Orderbook &orderbook, InstrumentStats *out) {
+  *out = orderbook.stats;
+}
+
+void reset_instrument_stats(Orderbook &orderbook) { orderbook.stats = {}; }
+
+void dump_instrument_stats(Orderbook &orderbook, std::FILE *out) {
+  const InstrumentStats &stats = orderbook.stats;
+  auto line = [out](const char *name, const Log2Histogram &h) {
+    if (h.count == 0)
+      return;
+    // Quantiles are bucket upper bounds, so they are exact to a factor of 2
+    std::fprintf(out,
+                 "  %-26s n=%-10llu mean %9.1f  p50 <=%-7llu p99 <=%-8llu "
+                 "p99.9 <=%-9llu max %llu\n",
+                 name, (unsigned long long)h.count, (double)h.sum / h.count,
+                 (unsigned long long)h.quantile(0.50),
+                 (unsigned long long)h.quantile(0.99),
+                 (unsigned long long)h.quantile(0.999),
+                 (unsigned long long)h.max);
+  };
+  line("match_order cycles", stats.matchCycles);
+  line("modify_order_by_id cycles", stats.modifyCycles);
+  line("get_volume_at_level cycles", stats.volumeCycles);
+  line("levels per match", stats.levelsPerMatch);
+  line("orders per match", stats.ordersPerMatch);
+  line("index probe length", stats.indexProbes);
+  std::fprintf(out, "  %-26s %llu\n", "allocations",
+               (unsigned long long)stats.allocations);
+}
+
+void enable_volume_index(Orderbook &orderbook) {
+  if (orderbook.buyVolume)
+    return;
+  VolumeTree *buyVolume = orderbook.arena.construct_array<VolumeTree>(1);
+  VolumeTree *sellVolume = orderbook.arena.construct_array<VolumeTree>(1);
+  buyVolume->build(
+      [&](uint32_t price) { return orderbook.buyOrders[price].volume; });
+  sellVolume->build(
+      [&](uint32_t price) { return orderbook.sellOrders[price].volume; });
+  orderbook.buyVolume = buyVolume;
+  orderbook.sellVolume = sellVolume;
+}
+
+template <Side S>
+static uint64_t volume_through_price(Orderbook &orderbook, PriceType price) {
+  using Book = BookSide<S>;
+  if (const VolumeTree *tree = Book::volume(orderbook))
+    return Book::volume_through(*tree, price);
+  uint64_t volume = 0;
+  walk_levels<S>(orderbook, price, [&](PriceType, const PriceLevel &level) {
+    volume += level.volume;
+    return true;
+  });
+  return volume;
+}
+
+template <Side S>
+static int32_t price_for_quantity(Orderbook &orderbook, uint64_t quantity) {
+  using Book = BookSide<S>;
+  if (quantity == 0)
+    return -1;
+  if (const VolumeTree *tree = Book::volume(orderbook))
+    return tree->total() >= quantity ? Book::price_for(*tree, quantity) : -1;
+  uint64_t volume = 0;
+  int32_t reached = -1;
+  walk_levels<S>(orderbook, Book::kWorst,
+                 [&](PriceType price, const PriceLevel &level) {
+                   volume += level.volume;
+                   if (volume < quantity)
+                     return true;
+                   reached = price;
+                   return false;
+                 });
+  return reached;
+}
+
+uint64_t get_volume_through_price(Orderbook &orderbook, Side side,
+                                  PriceType price) {
+  return side == Side::BUY ? volume_through_price<Side::BUY>(orderbook, price)
+                           : volume_through_price<Side::SELL>(orderbook, price);
+}
+
+int32_t get_price_for_quantity(Orderbook &orderbook, Side side,
+                               uint64_t quantity) {
+  return side == Side::BUY ? price_for_quantity<Side::BUY>(orderbook, quantity)
+                           : price_for_quantity<Side::SELL>(orderbook, quantity);
+}
+
+uint32_t get_order_count_at_level(Orderbook &orderbook, Side side,
+                                  PriceType price) {
+  return side == Side::BUY ? orderbook.buyOrders[price].count
+                           : orderbook.sellOrders[price].count;
 }
 
 // Functions below here don't need to be performant. Just make sure they're
 // correct
 Order lookup_order_by_id(Orderbook &orderbook, IdType order_id) {
-  if ((orderbook.orders.find(order_id)!= orderbook.orders.end()) &&  orderbook.orders[order_id]->quantity>0){
-    return *orderbook.orders[order_id];
+  NodeIndex idx = orderbook.orders.find(order_id);
+  if (idx != kNullNode) {
+    return orderbook.pool.order(idx);
   }
   throw std::runtime_error("Order not found");
 }
 
 bool order_exists(Orderbook &orderbook, IdType order_id) {
+  return orderbook.orders.find(order_id) != kNullNode;
+}
 
-  
-  if ((orderbook.orders.find(order_id)!= orderbook.orders.end()) &&  orderbook.orders[order_id]->quantity>0){
-    return true;
+Orderbook *create_orderbook() { return new Orderbook; }
+
+void destroy_orderbook(Orderbook *orderbook) { delete orderbook; }
+
+// Element size of each order pool column, in OrderPool::for_each_column order
+constexpr uint64_t kPoolColumnSizes[] = {sizeof(OrderPool::HotNode),
+                                         sizeof(IdType), sizeof(Side),
+                                         sizeof(NodeIndex)};
+constexpr uint32_t kPoolColumns =
+    sizeof(kPoolColumnSizes) / sizeof(kPoolColumnSizes[0]);
+
+// Snapshot file layout: a SnapshotHeader, then each state section at the
+// offset the header records, every section starting on a cache line. The
+// order pool is saved as one section per column
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t priceLevels;
+  int32_t bestBid;
+  int32_t bestAsk;
+  uint32_t stpPolicy;
+  uint32_t volumeIndex; // 1 if the volume index was on; rebuilt on load
+  OrderPool::State pool;
+  uint64_t indexCapacity;
+  uint64_t indexCount;
+  uint64_t buyLevelsOffset;
+  uint64_t sellLevelsOffset;
+  uint64_t buyBitmapOffset;
+  uint64_t sellBitmapOffset;
+  uint64_t columnOffsets[kPoolColumns];
+  uint64_t indexOffset;
+  uint64_t ownersOffset; // 0 unless a self-trade policy is set
+  uint64_t totalBytes;
+};
+
+constexpr char kSnapshotMagic[8] = {'L', 'L', 'L', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kSnapshotVersion = 4;
+
+static_assert(std::is_trivially_copyable<PriceLevel>::value &&
+                  std::is_trivially_copyable<PriceBitmap>::value,
+              "snapshot sections are copied as raw bytes");
+
+static uint64_t align_section(uint64_t offset) { return (offset + 63) & ~63ull; }
+
+// Fills in the section offsets for a book with the given pool and index sizes
+static void layout_snapshot(SnapshotHeader &h) {
+  uint64_t levelBytes = sizeof(PriceLevel) * kPriceLevels;
+  h.buyLevelsOffset = align_section(sizeof(SnapshotHeader));
+  h.sellLevelsOffset = align_section(h.buyLevelsOffset + levelBytes);
+  h.buyBitmapOffset = align_section(h.sellLevelsOffset + levelBytes);
+  h.sellBitmapOffset = align_section(h.buyBitmapOffset + sizeof(PriceBitmap));
+  uint64_t offset = align_section(h.sellBitmapOffset + sizeof(PriceBitmap));
+  for (uint32_t c = 0; c < kPoolColumns; ++c) {
+    h.columnOffsets[c] = offset;
+    offset = align_section(offset + kPoolColumnSizes[c] * (uint64_t)h.pool.bump);
+  }
+  h.indexOffset = offset;
+  h.totalBytes =
+      h.indexOffset + sizeof(OrderIndex::Slot) * (uint64_t)h.indexCapacity;
+  h.ownersOffset = 0;
+  if (h.stpPolicy != (uint32_t)StpPolicy::NONE) {
+    h.ownersOffset = align_section(h.totalBytes);
+    h.totalBytes = h.ownersOffset + sizeof(OwnerId) * (uint64_t)h.pool.bump;
   }
-  return false;
 }
 
-Orderbook *create_orderbook() { return new Orderbook; }
+bool save_orderbook_snapshot(const Orderbook &orderbook, const char *path) {
+  SnapshotHeader h = {};
+  std::memcpy(h.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  h.version = kSnapshotVersion;
+  h.priceLevels = kPriceLevels;
+  h.bestBid = orderbook.bestBid;
+  h.bestAsk = orderbook.bestAsk;
+  h.stpPolicy = (uint32_t)orderbook.stp;
+  h.volumeIndex = orderbook.buyVolume != nullptr;
+  h.pool = orderbook.pool.state();
+  h.indexCapacity = orderbook.orders.capacity();
+  h.indexCount = orderbook.orders.size();
+  layout_snapshot(h);
+
+  std::string tmp = std::string(path) + ".tmp";
+  std::FILE *f = std::fopen(tmp.c_str(), "wb");
+  if (!f)
+    return false;
+  uint64_t written = 0;
+  auto section = [&](uint64_t offset, const void *data, uint64_t bytes) {
+    static const char zeros[64] = {};
+    bool ok = true;
+    if (offset > written)
+      ok = std::fwrite(zeros, 1, offset - written, f) == offset - written;
+    ok = ok && std::fwrite(data, 1, bytes, f) == bytes;
+    written = offset + bytes;
+    return ok;
+  };
+  bool ok =
+      section(0, &h, sizeof(h)) &&
+      section(h.buyLevelsOffset, orderbook.buyOrders,
+              sizeof(PriceLevel) * kPriceLevels) &&
+      section(h.sellLevelsOffset, orderbook.sellOrders,
+              sizeof(PriceLevel) * kPriceLevels) &&
+      section(h.buyBitmapOffset, orderbook.buyLevels, sizeof(PriceBitmap)) &&
+      section(h.sellBitmapOffset, orderbook.sellLevels, sizeof(PriceBitmap));
+  uint32_t column = 0;
+  orderbook.pool.for_each_column([&](const void *base, size_t elementSize) {
+    ok = ok && section(h.columnOffsets[column++], base,
+                       elementSize * (uint64_t)h.pool.bump);
+  });
+  ok = ok &&
+      section(h.indexOffset, orderbook.orders.data(),
+              sizeof(OrderIndex::Slot) * h.indexCapacity);
+  if (h.ownersOffset)
+    ok = ok && section(h.ownersOffset, orderbook.pool.owner_data(),
+                       sizeof(OwnerId) * (uint64_t)h.pool.bump);
+  ok = (std::fclose(f) == 0) && ok;
+  if (!ok || std::rename(tmp.c_str(), path) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+Orderbook *load_orderbook_snapshot(const char *path) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+    ::close(fd);
+    return nullptr;
+  }
+  size_t bytes = st.st_size;
+  void *base = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  const char *p = static_cast<const char *>(base);
+  SnapshotHeader h;
+  std::memcpy(&h, p, sizeof(h));
+  SnapshotHeader expected = h;
+  layout_snapshot(expected);
+  Orderbook *orderbook = nullptr;
+  if (std::memcmp(h.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0 &&
+      h.version == kSnapshotVersion && h.priceLevels == kPriceLevels &&
+      std::memcmp(&h, &expected, sizeof(h)) == 0 && h.totalBytes <= bytes &&
+      h.pool.bump <= h.pool.capacity && h.indexCapacity != 0 &&
+      (h.indexCapacity & (h.indexCapacity - 1)) == 0 &&
+      h.stpPolicy <= (uint32_t)StpPolicy::DECREMENT_BOTH &&
+      h.volumeIndex <= 1) {
+    orderbook = new Orderbook(h.pool.capacity);
+    std::memcpy(orderbook->buyOrders, p + h.buyLevelsOffset,
+                sizeof(PriceLevel) * kPriceLevels);
+    std::memcpy(orderbook->sellOrders, p + h.sellLevelsOffset,
+                sizeof(PriceLevel) * kPriceLevels);
+    std::memcpy(orderbook->buyLevels, p + h.buyBitmapOffset,
+                sizeof(PriceBitmap));
+    std::memcpy(orderbook->sellLevels, p + h.sellBitmapOffset,
+                sizeof(PriceBitmap));
+    orderbook->bestBid = h.bestBid;
+    orderbook->bestAsk = h.bestAsk;
+    orderbook->pool.restore(h.pool);
+    uint32_t column = 0;
+    orderbook->pool.for_each_column([&](void *base, size_t elementSize) {
+      std::memcpy(base, p + h.columnOffsets[column++],
+                  elementSize * (uint64_t)h.pool.bump);
+    });
+    orderbook->orders.restore(
+        reinterpret_cast<const OrderIndex::Slot *>(p + h.indexOffset),
+        h.indexCapacity, h.indexCount);
+    if (h.ownersOffset) {
+      set_self_trade_policy(*orderbook, (StpPolicy)h.stpPolicy);
+      std::memcpy(&orderbook->pool.owner(0), p + h.ownersOffset,
+                  sizeof(OwnerId) * (uint64_t)h.pool.bump);
+    }
+    if (h.volumeIndex)
+      enable_volume_index(*orderbook);
+  }
+  ::munmap(base, bytes);
+  return orderbook;
+}
+
+Orderbook *create_orderbook_with_capacity(uint32_t order_capacity) {
+  return new Orderbook(order_capacity);
+}
+
+void reserve_orders(Orderbook &orderbook, uint32_t order_count) {
+  orderbook.pool.reserve(order_count);
+  orderbook.orders.reserve(order_count);
+}
+
+PoolStats get_order_pool_stats(Orderbook &orderbook) {
+  return orderbook.pool.stats();
+}
+
+ArenaStats get_arena_stats(Orderbook &orderbook) {
+  return orderbook.arena.stats();
+}
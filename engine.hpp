@@ -1,11 +1,14 @@
 #pragma once
 
 #include <cstdint>
-#include <list>
-#include <map>
-#include <vector>
-#include <unordered_map>
-#include <memory>
+#include <cstdio>
+#include <cstring>
+
+#include "arena.hpp"
+#include "instrument.hpp"
+#include "order_index.hpp"
+#include "price_bitmap.hpp"
+#include "volume_tree.hpp"
 
 enum class Side : uint8_t { BUY, SELL };
 
@@ -13,6 +16,27 @@ using IdType = uint32_t;
 using PriceType = uint16_t;
 using QuantityType = uint16_t;
 
+// How long an incoming order may live. GTC rests any unfilled remainder; IOC
+// matches what it can and drops the rest; FOK fills completely or does
+// nothing; POST_ONLY only ever rests, and is dropped if it would match
+enum class TimeInForce : uint8_t { GTC, IOC, FOK, POST_ONLY };
+
+// Identifies the firm or account behind an order for self-trade prevention.
+// Tags live in an engine-side table, not in Order. kNoOwner never matches
+using OwnerId = uint32_t;
+constexpr OwnerId kNoOwner = 0;
+
+// What happens when an incoming order would trade against a resting order of
+// the same owner. CANCEL_NEWEST drops the rest of the incoming order;
+// CANCEL_OLDEST cancels the resting order and keeps matching; DECREMENT_BOTH
+// takes the smaller quantity off both without a fill and keeps matching
+enum class StpPolicy : uint8_t {
+  NONE,
+  CANCEL_NEWEST,
+  CANCEL_OLDEST,
+  DECREMENT_BOTH
+};
+
 // You CANNOT change this
 struct Order {
   IdType id; // Unique
@@ -21,17 +45,304 @@ struct Order {
   Side side;
 };
 
-struct PriceLevel{
-  long unsigned int index;
-  std::vector<std::shared_ptr<Order>> orders;
-  int volume;
+// Number of distinct prices representable by PriceType
+constexpr uint32_t kPriceLevels = 1u << (8 * sizeof(PriceType));
+static_assert(PriceBitmap::kSize == kPriceLevels, "bitmap must span PriceType");
+
+// Nodes are addressed by 32-bit index rather than pointer, which keeps them
+// small and keeps links valid when the slab grows
+using NodeIndex = uint32_t;
+constexpr NodeIndex kNullNode = UINT32_MAX;
+static_assert(kNullNode == OrderIndex::kNotFound, "index misses are null nodes");
+
+struct PoolStats {
+  uint32_t capacity;
+  uint32_t inUse;
+  uint32_t highWater;
+  uint32_t exhaustions; // times the slab was full and had to grow
+};
+
+// Slab of resting order nodes with a LIFO free list. Freed nodes are reused
+// first, so a warm book never touches the global allocator. Running out of
+// nodes doubles the slab, which is counted as an exhaustion.
+//
+// Nodes are stored column-wise and split by temperature. The hot column packs
+// what a sweep reads for every order it passes, the next link and quantity
+// (plus the price, which fills its spare bytes), into one 8-byte record, so
+// walking a level costs one cache line per order. Ids, sides and prev links
+// are only needed to report a fill, unlink an order or look one up, and each
+// sits in its own cold column. While a node is on the free list, its next
+// link points at the next free node.
+//
+// Columns come from arena when one is given, from the heap otherwise. Growing
+// inside an arena leaves the old, smaller columns behind until the arena goes.
+class OrderPool {
+public:
+  static constexpr uint32_t kDefaultCapacity = 1u << 16;
+  struct HotNode {
+    NodeIndex next;
+    QuantityType quantity;
+    PriceType price;
+  };
+  static_assert(sizeof(HotNode) == 8, "hot node fields share 8 bytes");
+
+  // Bytes of column storage per node
+  static constexpr size_t kNodeBytes =
+      sizeof(HotNode) + sizeof(IdType) + sizeof(Side) + sizeof(NodeIndex);
+
+  explicit OrderPool(uint32_t capacity = kDefaultCapacity,
+                     Arena *arena = nullptr)
+      : arena(arena) {
+    grow(capacity ? capacity : 1);
+  }
+
+  NodeIndex allocate() {
+    NodeIndex idx;
+    if (freeHead != kNullNode) {
+      idx = freeHead;
+      freeHead = hot[idx].next;
+    } else {
+      // Nodes past the bump cursor have never been handed out, so the free
+      // list does not need to be threaded through them up front
+      if (bump == cap) {
+        grow(cap * 2);
+        ++exhaustions;
+      }
+      idx = bump++;
+    }
+    if (++inUse > highWater)
+      highWater = inUse;
+    return idx;
+  }
+
+  void release(NodeIndex idx) {
+    hot[idx].next = freeHead;
+    freeHead = idx;
+    --inUse;
+  }
+
+  IdType &id(NodeIndex idx) { return ids[idx]; }
+  PriceType &price(NodeIndex idx) { return hot[idx].price; }
+  QuantityType &quantity(NodeIndex idx) { return hot[idx].quantity; }
+  Side &side(NodeIndex idx) { return sides[idx]; }
+  NodeIndex &prev(NodeIndex idx) { return prevs[idx]; }
+  NodeIndex &next(NodeIndex idx) { return hot[idx].next; }
+  IdType id(NodeIndex idx) const { return ids[idx]; }
+  QuantityType quantity(NodeIndex idx) const { return hot[idx].quantity; }
+  NodeIndex next(NodeIndex idx) const { return hot[idx].next; }
+
+  // Gathers a node back into the public Order layout
+  Order order(NodeIndex idx) const {
+    return {ids[idx], hot[idx].price, hot[idx].quantity, sides[idx]};
+  }
+  // Owner tags, one per node. The column only exists once enable_owners has
+  // been called, and enabling (again) clears every tag to kNoOwner
+  OwnerId &owner(NodeIndex idx) { return owners[idx]; }
+  OwnerId owner(NodeIndex idx) const { return owners[idx]; }
+  bool has_owners() const { return (bool)owners; }
+  void enable_owners() {
+    if (!owners)
+      owners = ArenaArray<OwnerId>(arena, cap);
+    std::memset(owners.get(), 0, sizeof(OwnerId) * cap);
+  }
+  const OwnerId *owner_data() const { return owners.get(); }
+
+  void store(NodeIndex idx, const Order &order) {
+    ids[idx] = order.id;
+    hot[idx].price = order.price;
+    hot[idx].quantity = order.quantity;
+    sides[idx] = order.side;
+  }
+
+  // Grows the slab ahead of time; this is not counted as an exhaustion
+  void reserve(uint32_t capacity) {
+    if (capacity > cap)
+      grow(capacity);
+  }
+
+  PoolStats stats() const { return {cap, inUse, highWater, exhaustions}; }
+
+  // Snapshot support. Only nodes below the bump cursor have ever been used,
+  // so their columns (free-list members included) plus this bookkeeping are
+  // the pool's entire state
+  struct State {
+    uint32_t capacity;
+    uint32_t bump;
+    NodeIndex freeHead;
+    uint32_t inUse;
+    uint32_t highWater;
+    uint32_t exhaustions;
+  };
+  State state() const {
+    return {cap, bump, freeHead, inUse, highWater, exhaustions};
+  }
+  void restore(const State &s) {
+    reserve(s.capacity);
+    bump = s.bump;
+    freeHead = s.freeHead;
+    inUse = s.inUse;
+    highWater = s.highWater;
+    exhaustions = s.exhaustions;
+  }
+
+  // Calls f(base, elementSize) for every column, always in the same order
+  template <typename F> void for_each_column(F &&f) const {
+    f(hot.get(), sizeof(HotNode));
+    f(ids.get(), sizeof(IdType));
+    f(sides.get(), sizeof(Side));
+    f(prevs.get(), sizeof(NodeIndex));
+  }
+
+private:
+  template <typename T>
+  void grow_column(ArenaArray<T> &column, uint32_t newCap) {
+    ArenaArray<T> bigger(arena, newCap);
+    if (column)
+      std::memcpy(bigger.get(), column.get(), sizeof(T) * bump);
+    column = std::move(bigger);
+  }
+
+  void grow(uint32_t newCap) {
+    grow_column(hot, newCap);
+    grow_column(ids, newCap);
+    grow_column(sides, newCap);
+    grow_column(prevs, newCap);
+    if (owners)
+      grow_column(owners, newCap);
+    cap = newCap;
+  }
+
+  Arena *arena;
+  ArenaArray<HotNode> hot;
+  ArenaArray<IdType> ids;
+  ArenaArray<Side> sides;
+  ArenaArray<NodeIndex> prevs;
+  ArenaArray<OwnerId> owners;
+  uint32_t cap = 0;
+  uint32_t bump = 0;
+  NodeIndex freeHead = kNullNode;
+  uint32_t inUse = 0;
+  uint32_t highWater = 0;
+  uint32_t exhaustions = 0;
+};
+
+// Orders at a price form an intrusive FIFO from head to tail through the pool.
+// volume is the exact sum of live resting quantities at the level and count
+// the number of orders in it, both kept up to date by every fill, modify and
+// insert. The header is 16 bytes and 16-byte aligned, so all of it always
+// shares one cache line and four adjacent levels share each line
+struct alignas(16) PriceLevel {
+  NodeIndex head = kNullNode;
+  NodeIndex tail = kNullNode;
+  uint32_t volume = 0;
+  uint32_t count = 0;
+};
+static_assert(sizeof(PriceLevel) == 16, "a level header is 16 bytes");
+
+// One execution between a resting order and the incoming order that hit it,
+// at the resting order's price
+struct Fill {
+  IdType restingId;
+  IdType incomingId;
+  PriceType price;
+  QuantityType quantity;
+};
+
+// A change to the total resting volume at one level. volume is the level's
+// new total; 0 means the level is now empty
+struct DepthUpdate {
+  Side side;
+  PriceType price;
+  uint32_t volume;
+};
+
+// One level of an aggregated depth snapshot
+struct DepthLevel {
+  PriceType price;
+  uint32_t volume;
+};
+
+// What one price level would contribute to a simulated match
+struct SimLevel {
+  PriceType price;
+  uint32_t quantity; // filled at this price
+  uint32_t orders;   // resting orders touched, as counted by match_order
+};
+
+// Result of simulate_match. The caller points levels at a buffer of
+// levelCapacity entries (or leaves it null); everything else is output.
+// levelCount counts every level the order would reach, so when it exceeds
+// levelCapacity only the best levelCapacity were written
+struct SimResult {
+  SimLevel *levels;
+  uint32_t levelCapacity;
+  uint32_t levelCount;
+  uint32_t matchCount;        // what match_order would return
+  uint64_t filledQuantity;
+  uint64_t notional;          // sum of price * quantity over every fill
+  double averagePrice;        // notional / filledQuantity, 0 if nothing fills
+  QuantityType restingQuantity; // remainder that would be left on the book
+};
+
+// Caller-owned ring of output records. written counts every record ever
+// appended; record n lives at buffer[n & mask]. A consumer that falls more
+// than a buffer behind loses the oldest records
+template <typename Record> struct RecordSink {
+  Record *buffer = nullptr;
+  uint32_t mask = 0;
+  uint64_t written = 0;
+
+  void push(const Record &record) { buffer[written++ & mask] = record; }
 };
 
+class JournalWriter;
+
 // You CAN and SHOULD change this
+// Price levels are stored in flat arrays indexed directly by price, with the
+// touch on each side tracked incrementally. An empty side is marked by a best
+// price one step past the end of the ladder (-1 for bids, kPriceLevels for asks)
+// A price's bit in the side's occupancy bitmap is set while its level is live
+// The ladders, bitmaps, order pool and id index all live in the book's arena,
+// which is sized up front for orderCapacity resting orders
 struct Orderbook {
-  std::map<PriceType, PriceLevel, std::greater<PriceType>> buyOrders;
-  std::map<PriceType, PriceLevel> sellOrders;
-  std::unordered_map<IdType, std::shared_ptr<Order>> orders;
+  Arena arena; // first, so it outlives everything allocated from it
+  PriceLevel *buyOrders;
+  PriceLevel *sellOrders;
+  PriceBitmap *buyLevels;
+  PriceBitmap *sellLevels;
+  // Cumulative volume per side, only while enable_volume_index is on
+  VolumeTree *buyVolume = nullptr;
+  VolumeTree *sellVolume = nullptr;
+  int32_t bestBid;
+  int32_t bestAsk;
+  OrderPool pool;
+  OrderIndex orders;
+  RecordSink<Fill> fills;
+  RecordSink<DepthUpdate> depth;
+  JournalWriter *journal = nullptr;
+  StpPolicy stp = StpPolicy::NONE;
+  InstrumentStats stats{};
+
+  explicit Orderbook(uint32_t orderCapacity = OrderPool::kDefaultCapacity)
+      : arena(arena_bytes(orderCapacity)),
+        buyOrders(arena.construct_array<PriceLevel>(kPriceLevels)),
+        sellOrders(arena.construct_array<PriceLevel>(kPriceLevels)),
+        buyLevels(arena.construct_array<PriceBitmap>(1)),
+        sellLevels(arena.construct_array<PriceBitmap>(1)), bestBid(-1),
+        bestAsk(kPriceLevels), pool(orderCapacity, &arena),
+        orders(orderCapacity, &arena) {}
+
+  Orderbook(const Orderbook &) = delete;
+  Orderbook &operator=(const Orderbook &) = delete;
+
+  // Arena size that fits the ladders, bitmaps, a full pool and an id index
+  // at most a quarter loaded, with a cache line of padding per allocation
+  static size_t arena_bytes(uint32_t orderCapacity) {
+    return 2 * (sizeof(PriceLevel) * kPriceLevels + sizeof(PriceBitmap)) +
+           (size_t)orderCapacity *
+               (OrderPool::kNodeBytes + 4 * sizeof(OrderIndex::Slot)) +
+           16 * 64;
+  }
 };
 
 extern "C" {
@@ -41,16 +352,172 @@ extern "C" {
 
 uint32_t match_order(Orderbook &orderbook, const Order &incoming);
 
-// Sets the new quantity of an order. If new_quantity==0, removes the order
+// match_order with an explicit time in force. match_order is the GTC case.
+// A FOK order that cannot fill completely at or inside its price, and a
+// POST_ONLY order that would cross, leave the book untouched and return 0.
+// Throws std::invalid_argument for a tif outside the enum
+uint32_t match_order_with_tif(Orderbook &orderbook, const Order &incoming,
+                              TimeInForce tif);
+
+// match_order_with_tif for an order tagged with owner. When the book has a
+// self-trade policy set, the order is never matched against a resting order
+// with the same tag; the policy decides what happens instead. Orders entered
+// any other way are untagged. A FOK order stays all or nothing: only volume
+// it could actually trade with counts, so the owner's own resting orders are
+// left out and, unless the policy is CANCEL_OLDEST, so is everything queued
+// behind the first of them
+uint32_t match_order_as(Orderbook &orderbook, const Order &incoming,
+                        TimeInForce tif, OwnerId owner);
+
+// Reports what match_order would do with incoming without touching the book:
+// the same fills in the same order, summarized per level into result, and the
+// same return value. It runs the same fill loop as matching over the same
+// resting orders, only reading them. Nothing is allocated, journaled or
+// written to sinks
+uint32_t simulate_match(const Orderbook &orderbook, const Order &incoming,
+                        SimResult *result);
+
+// simulate_match for match_order_with_tif. Orders are simulated untagged, so
+// a self-trade policy never applies. Throws std::invalid_argument for a tif
+// outside the enum
+uint32_t simulate_match_with_tif(const Orderbook &orderbook,
+                                 const Order &incoming, TimeInForce tif,
+                                 SimResult *result);
+
+// Sets the book's self-trade prevention policy. Owner tags are only recorded
+// while a policy is set, so switching it on clears the tags of orders already
+// resting. StpPolicy::NONE turns checking off and costs nothing per match.
+// The policy changes how orders match, so it is journaled like an input
+void set_self_trade_policy(Orderbook &orderbook, StpPolicy policy);
+
+// Sets the new quantity of an order. If new_quantity==0, removes the order.
+// A reduce keeps the order's queue position; an increase moves it to the back
+// of its level, as if it had just arrived
 void modify_order_by_id(Orderbook &orderbook, IdType order_id,
                         QuantityType new_quantity);
 
+// Cancel-replace in one call: moves a resting order to new_price with
+// new_quantity, keeping its id, side and owner. At a new price it loses its
+// queue position and is matched like a fresh order, so the number of matches
+// is returned. At the same price it behaves like modify_order_by_id and
+// returns 0, as does new_quantity==0, which cancels. Unknown ids are ignored
+uint32_t replace_order(Orderbook &orderbook, IdType order_id,
+                       PriceType new_price, QuantityType new_quantity);
+
+// Removes a resting order in O(1), unlinking it from its price level.
+// Returns false if the order is not resting
+bool cancel_order_by_id(Orderbook &orderbook, IdType order_id);
+
+// Batch entry points with the same semantics as calling match_order or
+// modify_order_by_id on each element in sequence. match_orders writes each
+// order's match count to matches_out[i]. Both prefetch the book state that
+// upcoming elements will touch while the current one is processed
+void match_orders(Orderbook &orderbook, const Order *orders, size_t count,
+                  uint32_t *matches_out);
+void modify_orders_by_id(Orderbook &orderbook, const IdType *order_ids,
+                         const QuantityType *new_quantities, size_t count);
+
+// Attaches a preallocated ring that match_order appends a Fill to for every
+// match, without allocating. capacity must be a power of two. Passing nullptr
+// detaches the sink, after which matching records nothing
+void attach_fill_sink(Orderbook &orderbook, Fill *buffer, uint32_t capacity);
+
+// Total number of fills appended to the attached sink so far
+uint64_t get_fill_count(Orderbook &orderbook);
+
+// Attaches a preallocated ring that receives one DepthUpdate per level whose
+// volume changed, coalesced per call: a match_order that sweeps 20 levels and
+// rests emits 21 updates. capacity must be a power of two; nullptr detaches
+void attach_depth_sink(Orderbook &orderbook, DepthUpdate *buffer,
+                       uint32_t capacity);
+
+// Total number of updates appended to the attached depth sink so far
+uint64_t get_depth_update_count(Orderbook &orderbook);
+
+// Writes up to n of the best non-empty levels on a side, best first, and
+// returns how many were written. Only live levels are visited
+uint32_t get_top_n_levels(Orderbook &orderbook, Side side, uint32_t n,
+                          DepthLevel *out);
+
+// Logs every subsequent match_order, modify_order_by_id and
+// cancel_order_by_id input to journal (see journal.hpp), along with
+// self-trade policy changes. A policy already set is logged on attach, so
+// replay starts from it. nullptr detaches.
+// The journal is owned by the caller and must outlive the attachment
+void attach_journal(Orderbook &orderbook, JournalWriter *journal);
+
+// Writes the complete book state (levels, FIFO queues, id index) to path as
+// a compact binary snapshot. The file is written under a temporary name and
+// renamed into place, so a reader never sees a partial snapshot. Returns
+// false on I/O failure
+bool save_orderbook_snapshot(const Orderbook &orderbook, const char *path);
+
+// Whether this build of the engine records InstrumentStats, i.e. was
+// compiled with -DLLL_INSTRUMENT. Without it the stats stay zero
+bool instrumentation_enabled();
+
+// Copies out, or clears, the instrumentation recorded for a book
+void get_instrument_stats(Orderbook &orderbook, InstrumentStats *out);
+void reset_instrument_stats(Orderbook &orderbook);
+
+// Writes a readable summary of a book's instrumentation to out: count, mean
+// and quantiles of each cycle histogram and per-match counter
+void dump_instrument_stats(Orderbook &orderbook, std::FILE *out);
+
 // Returns total resting volume at a given price point
 uint32_t get_volume_at_level(Orderbook &orderbook, Side side,
                              PriceType quantity);
 
+// Keeps a Fenwick tree of level volumes per side from now on, so the two
+// calls below answer in O(log P) instead of walking levels. It is updated once
+// per level a call changes, and FOK checks switch to it. Enabling builds it
+// from the current book in one O(P) pass; it cannot be turned off again
+void enable_volume_index(Orderbook &orderbook);
+
+// Total resting volume on a side from the touch through price inclusive: bids
+// at or above price, asks at or below it
+uint64_t get_volume_through_price(Orderbook &orderbook, Side side,
+                                  PriceType price);
+
+// The price a sweep would have to reach to fill quantity against side, i.e.
+// the least aggressive level it would touch, or -1 if the side does not hold
+// that much
+int32_t get_price_for_quantity(Orderbook &orderbook, Side side,
+                               uint64_t quantity);
+
+// Returns the number of orders resting at a given price point
+uint32_t get_order_count_at_level(Orderbook &orderbook, Side side,
+                                  PriceType price);
+
 // Performance of these do not matter. They are only used to check correctness
 Order lookup_order_by_id(Orderbook &orderbook, IdType order_id);
 bool order_exists(Orderbook &orderbook, IdType order_id);
 Orderbook *create_orderbook();
+
+// Frees a book from any of the create or load calls, releasing its whole
+// arena at once
+void destroy_orderbook(Orderbook *orderbook);
+
+// Creates an orderbook from a snapshot written by save_orderbook_snapshot.
+// The file is mapped and each state section copied in bulk; queues link by
+// node index, so no order is re-inserted and no link needs rewriting.
+// Returns nullptr if the file is missing or not a valid snapshot. The
+// self-trade policy and owner tags are restored; sinks and journals are not
+// part of a snapshot and start detached
+Orderbook *load_orderbook_snapshot(const char *path);
+
+// Creates an orderbook whose order pool is presized for order_capacity resting
+// orders, so that no allocation happens until that many rest at once
+Orderbook *create_orderbook_with_capacity(uint32_t order_capacity);
+
+// Presizes the order pool and id index for order_count resting orders
+void reserve_orders(Orderbook &orderbook, uint32_t order_count);
+
+// Reports the order pool's capacity, live count, high-water mark and the
+// number of times it ran out and had to grow
+PoolStats get_order_pool_stats(Orderbook &orderbook);
+
+// Reports how much memory the book's arena has mapped and handed out, and
+// how it is backed
+ArenaStats get_arena_stats(Orderbook &orderbook);
 }
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Hot-path instrumentation, compiled in only when the engine is built with
+// -DLLL_INSTRUMENT (see `make instrumentedBench`). In a normal build every
+// hook below is an empty inline function or a discarded if constexpr branch,
+// so the matching path is the same machine code as without instrumentation.
+// The stats themselves are always part of the Orderbook, so the struct layout
+// does not depend on the build flag; they simply stay zero.
+#ifdef LLL_INSTRUMENT
+constexpr bool kInstrumented = true;
+#else
+constexpr bool kInstrumented = false;
+#endif
+
+// Cycle counter where available, steady_clock ticks elsewhere
+static inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Power-of-two histogram of 64-bit samples. Bucket 0 counts zeros and bucket
+// b > 0 counts samples in [2^(b-1), 2^b), so recording is a clz and an add
+// and the whole histogram lives in a few cache lines
+struct Log2Histogram {
+  static constexpr uint32_t kBuckets = 65;
+
+  uint64_t buckets[kBuckets];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+
+  void record(uint64_t value) {
+    ++buckets[value ? 64 - __builtin_clzll(value) : 0];
+    ++count;
+    sum += value;
+    if (value > max)
+      max = value;
+  }
+
+  // Upper bound of the bucket holding quantile q, capped at the largest sample
+  uint64_t quantile(double q) const {
+    uint64_t rank = (uint64_t)(q * count);
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < kBuckets; ++b) {
+      seen += buckets[b];
+      if (seen > rank) {
+        uint64_t bound = b == 0 ? 0 : b == 64 ? UINT64_MAX : (1ull << b) - 1;
+        return bound < max ? bound : max;
+      }
+    }
+    return max;
+  }
+};
+
+// Everything the instrumented engine records. Cycle histograms are per call;
+// levels and orders are per match_order call; probe lengths are the number
+// of slots the id index looked at past an order's home slot
+struct InstrumentStats {
+  Log2Histogram matchCycles;
+  Log2Histogram modifyCycles;
+  Log2Histogram volumeCycles;
+  Log2Histogram levelsPerMatch;
+  Log2Histogram ordersPerMatch;
+  Log2Histogram indexProbes;
+  uint64_t allocations; // order nodes taken from the pool to rest an order
+};
+
+// Records the cycles spent between construction and destruction into a
+// histogram. Empty when instrumentation is compiled out
+class CycleTimer {
+public:
+  explicit CycleTimer(Log2Histogram &histogram) : histogram(histogram) {
+    if constexpr (kInstrumented)
+      start = read_cycles();
+  }
+  ~CycleTimer() {
+    if constexpr (kInstrumented)
+      histogram.record(read_cycles() - start);
+  }
+
+  CycleTimer(const CycleTimer &) = delete;
+  CycleTimer &operator=(const CycleTimer &) = delete;
+
+private:
+  Log2Histogram &histogram;
+  uint64_t start = 0;
+};
+
+static inline void instrument_record(Log2Histogram &histogram,
+                                     uint64_t value) {
+  if constexpr (kInstrumented)
+    histogram.record(value);
+}
+
+static inline void instrument_count(uint64_t &counter) {
+  if constexpr (kInstrumented)
+    ++counter;
+}
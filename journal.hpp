@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.hpp"
+#include "order_ingress.hpp"
+
+// Append-only binary journal of every input the engine is given, so a
+// session can be replayed offline into an identical book.
+//
+// Layout: a JournalHeader followed by fixed-width JournalRecords. The header's
+// count is updated on every append through the shared mapping, so a journal
+// left behind by a crashed process is still readable up to its last record.
+
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t count;
+};
+
+// One engine input. type is an OrderCommand::Type: NEW uses every field,
+// MODIFY uses id and quantity, REPLACE uses id, price and quantity, CANCEL
+// uses id, STP_POLICY holds the policy in quantity. Unused bytes are zero, which reads back as GTC and kNoOwner for
+// journals written before tif and owner were recorded
+struct JournalRecord {
+  IdType id;
+  PriceType price;
+  QuantityType quantity;
+  uint8_t type;
+  uint8_t side;
+  uint8_t tif;
+  uint8_t reserved;
+  OwnerId owner;
+};
+static_assert(sizeof(JournalRecord) == 16, "journal records are 16 bytes");
+
+constexpr char kJournalMagic[8] = {'L', 'L', 'L', 'J', 'R', 'N', 'L', '\0'};
+constexpr uint32_t kJournalVersion = 1;
+
+// Memory-mapped journal writer. Appending is a 16-byte store into the mapping
+// plus a header update; the kernel writes pages back in the background, so
+// the hot path never waits on I/O. When the preallocated region fills up the
+// file is extended and remapped, which is the only slow path, so size the
+// initial capacity for a full session.
+class JournalWriter {
+public:
+  explicit JournalWriter(const char *path, size_t capacity = 1u << 24) {
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw std::runtime_error(std::string("Cannot open journal ") + path);
+    map(capacity);
+    std::memcpy(header->magic, kJournalMagic, sizeof(kJournalMagic));
+    header->version = kJournalVersion;
+    header->recordSize = sizeof(JournalRecord);
+    header->count = 0;
+  }
+
+  ~JournalWriter() {
+    // Trim the unused tail so the file holds exactly the records written
+    size_t used = sizeof(JournalHeader) + header->count * sizeof(JournalRecord);
+    ::munmap(base, bytes);
+    if (::ftruncate(fd, used) != 0) {
+      // The header count still bounds the valid records
+    }
+    ::close(fd);
+  }
+
+  JournalWriter(const JournalWriter &) = delete;
+  JournalWriter &operator=(const JournalWriter &) = delete;
+
+  void append(OrderCommand::Type type, IdType id, PriceType price,
+              QuantityType quantity, Side side,
+              TimeInForce tif = TimeInForce::GTC, OwnerId owner = kNoOwner) {
+    uint64_t n = header->count;
+    if (n == capacity)
+      map(std::max<size_t>(1, capacity * 2));
+    JournalRecord &record = records[n];
+    record.id = id;
+    record.price = price;
+    record.quantity = quantity;
+    record.type = (uint8_t)type;
+    record.side = (uint8_t)side;
+    record.tif = (uint8_t)tif;
+    record.owner = owner;
+    header->count = n + 1;
+  }
+
+  uint64_t count() const { return header->count; }
+
+private:
+  // (Re)maps the file sized for the given number of records
+  void map(size_t records) {
+    size_t newBytes = sizeof(JournalHeader) + records * sizeof(JournalRecord);
+    if (::ftruncate(fd, newBytes) != 0)
+      throw std::runtime_error("Cannot size journal");
+    void *p = base ? ::mremap(base, bytes, newBytes, MREMAP_MAYMOVE)
+                   : ::mmap(nullptr, newBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Cannot map journal");
+    base = p;
+    bytes = newBytes;
+    capacity = records;
+    header = static_cast<JournalHeader *>(base);
+    this->records = reinterpret_cast<JournalRecord *>(header + 1);
+  }
+
+  int fd = -1;
+  void *base = nullptr;
+  size_t bytes = 0;
+  size_t capacity = 0;
+  JournalHeader *header = nullptr;
+  JournalRecord *records = nullptr;
+};
+
+// Read-only view of a journal file, mapped for the lifetime of the reader
+class JournalReader {
+public:
+  explicit JournalReader(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error(std::string("Cannot open journal ") + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(JournalHeader)) {
+      ::close(fd);
+      throw std::runtime_error("Journal is truncated");
+    }
+    bytes = st.st_size;
+    base = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+      throw std::runtime_error("Cannot map journal");
+    auto header = static_cast<const JournalHeader *>(base);
+    if (std::memcmp(header->magic, kJournalMagic, sizeof(kJournalMagic)) != 0 ||
+        header->version != kJournalVersion ||
+        header->recordSize != sizeof(JournalRecord)) {
+      ::munmap(base, bytes);
+      throw std::runtime_error("Not a journal this engine can read");
+    }
+    records = reinterpret_cast<const JournalRecord *>(header + 1);
+    size_t fit = (bytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+    n = header->count < fit ? header->count : fit;
+    // Replay reads front to back exactly once
+    ::madvise(base, bytes, MADV_SEQUENTIAL);
+  }
+
+  ~JournalReader() { ::munmap(base, bytes); }
+
+  JournalReader(const JournalReader &) = delete;
+  JournalReader &operator=(const JournalReader &) = delete;
+
+  size_t size() const { return n; }
+  const JournalRecord &operator[](size_t i) const { return records[i]; }
+
+  static OrderCommand to_command(const JournalRecord &record) {
+    return {(OrderCommand::Type)record.type,
+            Order{record.id, record.price, record.quantity, (Side)record.side},
+            (TimeInForce)record.tif, record.owner};
+  }
+
+private:
+  void *base = nullptr;
+  size_t bytes = 0;
+  const JournalRecord *records = nullptr;
+  size_t n = 0;
+};
+
+// Re-feeds every record of a journal into orderbook at full speed and returns
+// the number of records applied
+inline size_t replay_journal(const JournalReader &journal,
+                             Orderbook &orderbook) {
+  for (size_t i = 0; i < journal.size(); ++i)
+    apply_command(orderbook, JournalReader::to_command(journal[i]));
+  return journal.size();
+}
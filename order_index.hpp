@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "arena.hpp"
+
+// Open-addressing map from 32-bit order id to 32-bit node index.
+// Slots are 8 bytes in one contiguous power-of-two table, probed linearly from
+// a Fibonacci hash of the id, which spreads dense monotonic ids evenly across
+// the table. Deletion shifts later entries of the probe run back instead of
+// leaving tombstones, so lookups never slow down as orders come and go.
+// Tables come from arena when one is given, from the heap otherwise.
+class OrderIndex {
+public:
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  explicit OrderIndex(size_t expected = 0, Arena *arena = nullptr)
+      : arena(arena) {
+    rehash(capacity_for(expected));
+  }
+
+  // Returns the value stored for id, or kNotFound
+  uint32_t find(uint32_t id) const {
+    for (uint32_t i = home(id);; i = (i + 1) & mask) {
+      const Slot &slot = slots[i];
+      if (slot.value == kNotFound || slot.id == id)
+        return slot.value;
+    }
+  }
+
+  // Inserts or overwrites the value for id
+  void insert(uint32_t id, uint32_t value) {
+    if ((count + 1) * 2 > mask + 1)
+      rehash((mask + 1) * 2);
+    uint32_t i = home(id);
+    for (; slots[i].value != kNotFound; i = (i + 1) & mask) {
+      if (slots[i].id == id) {
+        slots[i].value = value;
+        return;
+      }
+    }
+    slots[i] = {id, value};
+    ++count;
+  }
+
+  // Removes id, returning whether it was present
+  bool erase(uint32_t id) {
+    uint32_t i = home(id);
+    for (; slots[i].id != id; i = (i + 1) & mask) {
+      if (slots[i].value == kNotFound)
+        return false;
+    }
+    if (slots[i].value == kNotFound)
+      return false;
+    // Backward-shift: pull later members of the run into the hole whenever
+    // their home slot does not lie cyclically between the hole and them
+    for (uint32_t j = (i + 1) & mask; slots[j].value != kNotFound;
+         j = (j + 1) & mask) {
+      uint32_t h = home(slots[j].id);
+      if (((j - h) & mask) >= ((j - i) & mask)) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i].value = kNotFound;
+    --count;
+    return true;
+  }
+
+  // Grows the table so that n entries fit without a rehash
+  void reserve(size_t n) {
+    size_t cap = capacity_for(n);
+    if (cap > mask + 1)
+      rehash(cap);
+  }
+
+  size_t size() const { return count; }
+
+  // Number of slots a lookup for id steps past its home slot before it ends
+  uint32_t probe_length(uint32_t id) const {
+    uint32_t start = home(id);
+    uint32_t i = start;
+    while (slots[i].value != kNotFound && slots[i].id != id)
+      i = (i + 1) & mask;
+    return (i - start) & mask;
+  }
+
+  // Address of the slot where a lookup for id starts, for prefetching
+  const void *home_slot(uint32_t id) const { return &slots[home(id)]; }
+
+  struct Slot {
+    uint32_t id;
+    uint32_t value;
+  };
+
+  // Snapshot support: the raw table. Restoring a table of the same capacity
+  // keeps every entry in its slot, so nothing is rehashed
+  size_t capacity() const { return mask + 1; }
+  const Slot *data() const { return slots.get(); }
+  void restore(const Slot *table, size_t cap, size_t entries) {
+    rehash(cap);
+    std::memcpy(slots.get(), table, sizeof(Slot) * cap);
+    count = entries;
+  }
+
+private:
+  // Smallest power of two keeping n entries at or under half load
+  static size_t capacity_for(size_t n) {
+    size_t cap = 16;
+    while (cap < n * 2)
+      cap *= 2;
+    return cap;
+  }
+
+  uint32_t home(uint32_t id) const {
+    return (uint32_t)(((uint64_t)id * 0x9E3779B97F4A7C15ull) >> shift);
+  }
+
+  void rehash(size_t cap) {
+    ArenaArray<Slot> old = std::move(slots);
+    size_t oldCap = old ? mask + 1 : 0;
+    slots = ArenaArray<Slot>(arena, cap);
+    std::memset(slots.get(), 0xFF, sizeof(Slot) * cap);
+    mask = (uint32_t)(cap - 1);
+    shift = 64 - __builtin_ctzll(cap);
+    count = 0;
+    for (size_t i = 0; i < oldCap; ++i) {
+      if (old[i].value != kNotFound)
+        insert(old[i].id, old[i].value);
+    }
+  }
+
+  Arena *arena;
+  ArenaArray<Slot> slots;
+  uint32_t mask = 0;
+  uint32_t shift = 0;
+  size_t count = 0;
+};
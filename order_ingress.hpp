@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "engine.hpp"
+#include "spsc_queue.hpp"
+
+// Fixed-size command record passed from a gateway thread to the thread that
+// owns an Orderbook. NEW carries the order, its time in force and its owner;
+// MODIFY carries the id and new quantity in order; REPLACE carries the id, new
+// price and new quantity in order; CANCEL carries the id in order.id;
+// STP_POLICY carries a StpPolicy in order.quantity
+struct OrderCommand {
+  enum class Type : uint8_t { NEW, MODIFY, CANCEL, REPLACE, STP_POLICY };
+  Type type;
+  Order order;
+  TimeInForce tif = TimeInForce::GTC;
+  OwnerId owner = kNoOwner;
+};
+
+// Ring for a consumer that busy-polls, and one whose consumer may also sleep
+// in wait_ingress at the cost of a fence on every push
+using IngressRing = SpscQueue<OrderCommand>;
+using BlockingIngressRing = SpscQueue<OrderCommand, true>;
+
+// Largest batch the drain helpers pull off the ring in one go
+constexpr size_t kIngressBatch = 64;
+
+// Applies one command and returns the number of matches it produced
+inline uint32_t apply_command(Orderbook &orderbook,
+                              const OrderCommand &command) {
+  switch (command.type) {
+  case OrderCommand::Type::NEW:
+    return match_order_as(orderbook, command.order, command.tif,
+                          command.owner);
+  case OrderCommand::Type::MODIFY:
+    modify_order_by_id(orderbook, command.order.id, command.order.quantity);
+    return 0;
+  case OrderCommand::Type::CANCEL:
+    cancel_order_by_id(orderbook, command.order.id);
+    return 0;
+  case OrderCommand::Type::REPLACE:
+    return replace_order(orderbook, command.order.id, command.order.price,
+                         command.order.quantity);
+  case OrderCommand::Type::STP_POLICY:
+    set_self_trade_policy(orderbook, (StpPolicy)command.order.quantity);
+    return 0;
+  }
+  return 0;
+}
+
+// Busy-poll consumer step: applies whatever is queued, up to maxBatch
+// commands, and returns how many were applied (possibly 0)
+template <bool Blocking>
+inline size_t poll_ingress(Orderbook &orderbook,
+                           SpscQueue<OrderCommand, Blocking> &ring,
+                           size_t maxBatch = kIngressBatch) {
+  OrderCommand batch[kIngressBatch];
+  size_t n = ring.try_pop_batch(batch, std::min(maxBatch, kIngressBatch));
+  for (size_t i = 0; i < n; ++i)
+    apply_command(orderbook, batch[i]);
+  return n;
+}
+
+// Blocking consumer step: sleeps until at least one command is queued, then
+// applies up to maxBatch of them and returns how many were applied
+inline size_t wait_ingress(Orderbook &orderbook, BlockingIngressRing &ring,
+                           size_t maxBatch = kIngressBatch) {
+  OrderCommand batch[kIngressBatch];
+  size_t n = ring.wait_pop_batch(batch, std::min(maxBatch, kIngressBatch));
+  for (size_t i = 0; i < n; ++i)
+    apply_command(orderbook, batch[i]);
+  return n;
+}
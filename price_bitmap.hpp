@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+
+// Three-level occupancy bitmap over the 16-bit price domain.
+// Level 0 holds one bit per price, level 1 one bit per non-zero level 0 word
+// and level 2 one bit per non-zero level 1 word, so any nearest-set-bit search
+// touches at most one word per level.
+class PriceBitmap {
+public:
+  static constexpr uint32_t kSize = 1u << 16;
+  static constexpr uint32_t kWords = kSize / 64;
+  static constexpr uint32_t kSummaryWords = kWords / 64;
+  static_assert(kSummaryWords <= 64, "top level must fit in a single word");
+
+  void set(uint32_t price) {
+    uint32_t w = price >> 6;
+    words[w] |= bit(price);
+    summary[w >> 6] |= bit(w);
+    top |= bit(w >> 6);
+  }
+
+  void clear(uint32_t price) {
+    uint32_t w = price >> 6;
+    words[w] &= ~bit(price);
+    if (words[w] != 0)
+      return;
+    summary[w >> 6] &= ~bit(w);
+    if (summary[w >> 6] == 0)
+      top &= ~bit(w >> 6);
+  }
+
+  bool test(uint32_t price) const { return words[price >> 6] & bit(price); }
+
+  bool empty() const { return top == 0; }
+
+  // Lowest set price >= price, or kSize if there is none
+  int32_t next_at_or_above(int32_t price) const {
+    if (price >= (int32_t)kSize)
+      return kSize;
+    if (price < 0)
+      price = 0;
+    uint32_t w = price >> 6;
+    uint64_t m = words[w] & (~0ull << (price & 63));
+    if (m)
+      return (w << 6) | ctz(m);
+    if (++w == kWords)
+      return kSize;
+    uint32_t s = w >> 6;
+    m = summary[s] & (~0ull << (w & 63));
+    if (!m) {
+      if (++s == kSummaryWords)
+        return kSize;
+      m = top & (~0ull << s);
+      if (!m)
+        return kSize;
+      s = ctz(m);
+      m = summary[s];
+    }
+    w = (s << 6) | ctz(m);
+    return (w << 6) | ctz(words[w]);
+  }
+
+  // Highest set price <= price, or -1 if there is none
+  int32_t next_at_or_below(int32_t price) const {
+    if (price < 0)
+      return -1;
+    if (price >= (int32_t)kSize)
+      price = kSize - 1;
+    uint32_t w = price >> 6;
+    uint64_t m = words[w] & (~0ull >> (63 - (price & 63)));
+    if (m)
+      return (w << 6) | msb(m);
+    if (w-- == 0)
+      return -1;
+    uint32_t s = w >> 6;
+    m = summary[s] & (~0ull >> (63 - (w & 63)));
+    if (!m) {
+      if (s-- == 0)
+        return -1;
+      m = top & (~0ull >> (63 - s));
+      if (!m)
+        return -1;
+      s = msb(m);
+      m = summary[s];
+    }
+    w = (s << 6) | msb(m);
+    return (w << 6) | msb(words[w]);
+  }
+
+  int32_t lowest() const { return next_at_or_above(0); }
+  int32_t highest() const { return next_at_or_below(kSize - 1); }
+
+private:
+  static constexpr uint64_t bit(uint32_t i) { return 1ull << (i & 63); }
+  static uint32_t ctz(uint64_t m) { return __builtin_ctzll(m); }
+  static uint32_t msb(uint64_t m) { return 63 - __builtin_clzll(m); }
+
+  uint64_t words[kWords] = {};
+  uint64_t summary[kSummaryWords] = {};
+  uint64_t top = 0;
+};
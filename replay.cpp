@@ -0,0 +1,39 @@
+#include "engine.hpp"
+#include "journal.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+// Rebuilds an Orderbook from a journal written by JournalWriter, re-feeding
+// every recorded input at full speed, and reports replay throughput.
+// Build with `make replay`. Usage: ./replay <journal> [repetitions]
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <journal> [repetitions]\n", argv[0]);
+    return 2;
+  }
+  int repetitions = argc > 2 ? std::atoi(argv[2]) : 1;
+  try {
+    JournalReader journal(argv[1]);
+    std::printf("%s: %zu records\n", argv[1], journal.size());
+    for (int r = 0; r < repetitions; ++r) {
+      Orderbook *ob = create_orderbook();
+      auto start = std::chrono::steady_clock::now();
+      replay_journal(journal, *ob);
+      double ns = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      PoolStats stats = get_order_pool_stats(*ob);
+      std::printf("replay %d: %.1f ns/record, %.2f Mrecords/s, %u resting "
+                  "orders, best bid %d, best ask %d\n",
+                  r, ns / journal.size(), journal.size() / ns * 1e3,
+                  stats.inUse, ob->bestBid, ob->bestAsk);
+      destroy_orderbook(ob);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+constexpr size_t kCacheLineSize = 64;
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity is rounded up to a power of two.
+//
+// The producer's and consumer's indices live on separate cache lines, and
+// each side keeps a private copy of the other's index that it refreshes only
+// when the queue looks full (or empty), so in steady state neither side
+// reads a line the other is writing.
+//
+// The consumer can always poll. Only a Blocking queue also lets it sleep in
+// wait_pop_batch; its producer then pays a full fence and a flag load per push
+// so that it never misses a sleeping consumer. A polling queue publishes with
+// a plain release store.
+template <typename T, bool Blocking = false> class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity)
+      cap *= 2;
+    slots.reset(new T[cap]);
+    mask = cap - 1;
+  }
+
+  // Producer side. Returns false if the queue is full
+  bool try_push(const T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cachedHead > mask) {
+      cachedHead = head.load(std::memory_order_acquire);
+      if (t - cachedHead > mask)
+        return false;
+    }
+    slots[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+    if constexpr (Blocking) {
+      // Pairs with the fence in wait_pop_batch: either the consumer sees the
+      // new tail before sleeping or we see that it is asleep
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleeping.load(std::memory_order_relaxed)) {
+        { std::lock_guard<std::mutex> lock(wakeMutex); }
+        wake.notify_one();
+      }
+    }
+    return true;
+  }
+
+  // Consumer side. Returns false if the queue is empty
+  bool try_pop(T &item) { return try_pop_batch(&item, 1) == 1; }
+
+  // Consumer side. Pops up to max items into out and returns how many, with a
+  // single release of the head index for the whole batch
+  size_t try_pop_batch(T *out, size_t max) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (cachedTail == h)
+      cachedTail = tail.load(std::memory_order_acquire);
+    size_t n = cachedTail - h;
+    if (n > max)
+      n = max;
+    for (size_t i = 0; i < n; ++i)
+      out[i] = slots[(h + i) & mask];
+    if (n)
+      head.store(h + n, std::memory_order_release);
+    return n;
+  }
+
+  // Consumer side. Like try_pop_batch, but sleeps until at least one item is
+  // available instead of returning 0
+  size_t wait_pop_batch(T *out, size_t max) {
+    static_assert(Blocking, "only a Blocking queue wakes a waiting consumer");
+    for (;;) {
+      if (size_t n = try_pop_batch(out, max))
+        return n;
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake.wait(lock, [&] {
+        return tail.load(std::memory_order_acquire) !=
+               head.load(std::memory_order_relaxed);
+      });
+      sleeping.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+
+private:
+  // Producer-owned line
+  alignas(kCacheLineSize) std::atomic<size_t> tail{0};
+  size_t cachedHead = 0;
+  // Consumer-owned line
+  alignas(kCacheLineSize) std::atomic<size_t> head{0};
+  size_t cachedTail = 0;
+  // Blocking consumer support, rarely written
+  alignas(kCacheLineSize) std::atomic<bool> sleeping{false};
+  std::mutex wakeMutex;
+  std::condition_variable wake;
+  // Read-only after construction
+  alignas(kCacheLineSize) std::unique_ptr<T[]> slots;
+  size_t mask;
+};
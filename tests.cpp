@@ -1,7 +1,14 @@
 #include "engine.hpp"
+#include "book_manager.hpp"
+#include "journal.hpp"
+#include "order_ingress.hpp"
+#include "order_index.hpp"
+#include "price_bitmap.hpp"
 #include <cassert>
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <thread>
 
 // We may add to these later on, but will provide additional tests before the
 // deadline
@@ -718,6 +725,1231 @@ void test_get_volume_all_encompassing() {
   std::cout << "Test 28 passed." << std::endl;
 }
 
+// Test 29: Price bitmap nearest-set-bit searches.
+void test_price_bitmap() {
+  std::cout << "Test 29: Price bitmap nearest-set-bit searches" << std::endl;
+  PriceBitmap bm;
+  assert(bm.empty());
+  assert(bm.lowest() == (int32_t)PriceBitmap::kSize);
+  assert(bm.highest() == -1);
+
+  // Prices chosen to straddle word (64) and summary word (4096) boundaries.
+  bm.set(0);
+  bm.set(63);
+  bm.set(64);
+  bm.set(4095);
+  bm.set(4096);
+  bm.set(65535);
+  assert(!bm.empty());
+  assert(bm.test(63) && !bm.test(62));
+  assert(bm.lowest() == 0);
+  assert(bm.highest() == 65535);
+  assert(bm.next_at_or_above(1) == 63);
+  assert(bm.next_at_or_above(65) == 4095);
+  assert(bm.next_at_or_above(4097) == 65535);
+  assert(bm.next_at_or_below(65534) == 4096);
+  assert(bm.next_at_or_below(4095) == 4095);
+  assert(bm.next_at_or_below(62) == 0);
+  assert(bm.next_at_or_below(-1) == -1);
+
+  // Clearing a whole word must also clear its summary bits.
+  bm.clear(4096);
+  bm.clear(4095);
+  assert(bm.next_at_or_above(65) == 65535);
+  assert(bm.next_at_or_below(65534) == 64);
+  bm.clear(0);
+  bm.clear(63);
+  bm.clear(64);
+  bm.clear(65535);
+  assert(bm.empty());
+  assert(bm.next_at_or_above(0) == (int32_t)PriceBitmap::kSize);
+  assert(bm.next_at_or_below(65535) == -1);
+
+  std::cout << "Test 29 passed." << std::endl;
+}
+
+// Test 30: Aggressive sweep across sparse price levels.
+void test_sweep_sparse_levels() {
+  std::cout << "Test 30: Aggressive sweep across sparse price levels"
+            << std::endl;
+  Orderbook ob;
+  // Rest one sell order every 1000 ticks, spanning many bitmap words.
+  for (IdType i = 0; i < 50; ++i) {
+    Order sellOrder{600 + i, (PriceType)(1000 + i * 1000), 2, Side::SELL};
+    match_order(ob, sellOrder);
+  }
+  // Sweep the first 40 levels and leave the remainder resting at the limit.
+  Order buyOrder{700, 40000, 81, Side::BUY};
+  uint32_t matches = match_order(ob, buyOrder);
+  assert(matches == 40);
+  assert(!order_exists(ob, 639));
+  assert(order_exists(ob, 640));
+  assert(get_volume_at_level(ob, Side::BUY, 40000) == 1);
+  assert(get_volume_at_level(ob, Side::SELL, 41000) == 2);
+
+  // A sell sweep walks down through the bids, crossing the resting buy.
+  Order buyOrder2{701, 500, 3, Side::BUY};
+  match_order(ob, buyOrder2);
+  Order sellOrder{702, 0, 10, Side::SELL};
+  matches = match_order(ob, sellOrder);
+  assert(matches == 2);
+  assert(get_volume_at_level(ob, Side::SELL, 0) == 6);
+  assert(get_volume_at_level(ob, Side::BUY, 500) == 0);
+
+  std::cout << "Test 30 passed." << std::endl;
+}
+
+// Test 31: Level volume stays exact across fills, modifies and cancels.
+void test_volume_aggregate_consistency() {
+  std::cout << "Test 31: Level volume stays exact across fills, modifies and "
+               "cancels"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrder1{800, 100, 10, Side::SELL};
+  Order sellOrder2{801, 100, 20, Side::SELL};
+  Order sellOrder3{802, 101, 5, Side::SELL};
+  match_order(ob, sellOrder1);
+  match_order(ob, sellOrder2);
+  match_order(ob, sellOrder3);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 30);
+
+  // Increase, then cancel, a resting order.
+  modify_order_by_id(ob, 801, 25);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 35);
+  modify_order_by_id(ob, 800, 0);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 25);
+  // Modifying a cancelled order must not bring its volume back.
+  modify_order_by_id(ob, 800, 7);
+  assert(!order_exists(ob, 800));
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 25);
+
+  // Sweep through level 100 into 101.
+  Order buyOrder{803, 101, 27, Side::BUY};
+  match_order(ob, buyOrder);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 0);
+  assert(get_volume_at_level(ob, Side::SELL, 101) == 3);
+  // Modifying a filled order must not bring its volume back either.
+  modify_order_by_id(ob, 801, 4);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 0);
+
+  std::cout << "Test 31 passed." << std::endl;
+}
+
+// Test 32: Order pool reuses freed nodes and reports its counters.
+void test_order_pool_stats() {
+  std::cout << "Test 32: Order pool reuses freed nodes and reports its counters"
+            << std::endl;
+  Orderbook *ob = create_orderbook_with_capacity(2);
+  PoolStats stats = get_order_pool_stats(*ob);
+  assert(stats.capacity == 2);
+  assert(stats.inUse == 0);
+
+  // Resting a third order overflows the slab once.
+  for (IdType i = 0; i < 3; ++i) {
+    Order sellOrder{900 + i, 100, 5, Side::SELL};
+    match_order(*ob, sellOrder);
+  }
+  stats = get_order_pool_stats(*ob);
+  assert(stats.capacity == 4);
+  assert(stats.inUse == 3);
+  assert(stats.highWater == 3);
+  assert(stats.exhaustions == 1);
+
+  // Filled nodes go back to the free list and are reused without growing.
+  Order buyOrder{903, 100, 10, Side::BUY};
+  match_order(*ob, buyOrder);
+  assert(get_order_pool_stats(*ob).inUse == 1);
+  for (IdType i = 0; i < 100; ++i) {
+    Order buy{1000 + i, 90, 1, Side::BUY};
+    Order sell{2000 + i, 90, 1, Side::SELL};
+    match_order(*ob, buy);
+    match_order(*ob, sell);
+  }
+  stats = get_order_pool_stats(*ob);
+  assert(stats.inUse == 1);
+  assert(stats.highWater == 3);
+  assert(stats.exhaustions == 1);
+  assert(lookup_order_by_id(*ob, 902).quantity == 5);
+
+  destroy_orderbook(ob);
+  std::cout << "Test 32 passed." << std::endl;
+}
+
+// Test 33: Cancels unlink orders so matching never sees them.
+void test_cancel_unlinks_order() {
+  std::cout << "Test 33: Cancels unlink orders so matching never sees them"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrder1{1100, 100, 5, Side::SELL};
+  Order sellOrder2{1101, 100, 5, Side::SELL};
+  Order sellOrder3{1102, 100, 5, Side::SELL};
+  Order sellOrder4{1103, 101, 5, Side::SELL};
+  match_order(ob, sellOrder1);
+  match_order(ob, sellOrder2);
+  match_order(ob, sellOrder3);
+  match_order(ob, sellOrder4);
+
+  // Cancel from the middle and head of the queue.
+  modify_order_by_id(ob, 1101, 0);
+  assert(cancel_order_by_id(ob, 1100));
+  assert(!cancel_order_by_id(ob, 1100));
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 5);
+  assert(get_order_pool_stats(ob).inUse == 2);
+
+  // Only the live order at 100 matches; cancelled ones are not counted.
+  Order buyOrder{1104, 100, 10, Side::BUY};
+  uint32_t matches = match_order(ob, buyOrder);
+  assert(matches == 1);
+  assert(get_volume_at_level(ob, Side::BUY, 100) == 5);
+
+  // Cancelling the last order at the touch moves the best ask.
+  cancel_order_by_id(ob, 1104);
+  Order sellOrder5{1105, 102, 5, Side::SELL};
+  match_order(ob, sellOrder5);
+  cancel_order_by_id(ob, 1103);
+  Order buyOrder2{1106, 102, 5, Side::BUY};
+  matches = match_order(ob, buyOrder2);
+  assert(matches == 1);
+  assert(!order_exists(ob, 1105));
+  assert(get_order_pool_stats(ob).inUse == 0);
+
+  std::cout << "Test 33 passed." << std::endl;
+}
+
+// Test 34: A touch level that never empties keeps memory proportional to
+// its live orders.
+void test_touch_level_memory_bounded() {
+  std::cout << "Test 34: Touch level memory stays proportional to live orders"
+            << std::endl;
+  Orderbook ob;
+  IdType id = 3000;
+  for (int i = 0; i < 10; ++i) {
+    Order sellOrder{id++, 100, 3, Side::SELL};
+    match_order(ob, sellOrder);
+  }
+  for (int i = 0; i < 20000; ++i) {
+    Order sellOrder{id++, 100, 3, Side::SELL};
+    Order buyOrder{id++, 100, 3, Side::BUY};
+    match_order(ob, sellOrder);
+    assert(match_order(ob, buyOrder) == 1);
+  }
+  PoolStats stats = get_order_pool_stats(ob);
+  assert(stats.inUse == 10);
+  assert(stats.highWater == 11);
+  assert(stats.exhaustions == 0);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 30);
+  std::cout << "Test 34 passed." << std::endl;
+}
+
+// Test 35: Order index insert, erase and growth.
+void test_order_index() {
+  std::cout << "Test 35: Order index insert, erase and growth" << std::endl;
+  OrderIndex index;
+  assert(index.find(1) == OrderIndex::kNotFound);
+  assert(!index.erase(1));
+
+  // Grow well past the initial table, then erase every other id so that
+  // backward shifting has to repair many probe runs.
+  for (uint32_t id = 0; id < 5000; ++id)
+    index.insert(id * 7, id);
+  assert(index.size() == 5000);
+  for (uint32_t id = 0; id < 5000; id += 2)
+    assert(index.erase(id * 7));
+  assert(index.size() == 2500);
+  for (uint32_t id = 0; id < 5000; ++id)
+    assert(index.find(id * 7) == (id % 2 ? id : OrderIndex::kNotFound));
+
+  // Overwrite, and ids at the edges of the range.
+  index.insert(7, 42);
+  assert(index.find(7) == 42);
+  index.insert(0, 1);
+  index.insert(UINT32_MAX, 2);
+  assert(index.find(0) == 1);
+  assert(index.find(UINT32_MAX) == 2);
+  assert(index.erase(UINT32_MAX));
+  assert(index.find(UINT32_MAX) == OrderIndex::kNotFound);
+
+  std::cout << "Test 35 passed." << std::endl;
+}
+
+// Test 36: Batch entry points match one-at-a-time calls.
+void test_batch_matches_sequential() {
+  std::cout << "Test 36: Batch entry points match one-at-a-time calls"
+            << std::endl;
+  Order orders[] = {
+      {1200, 100, 5, Side::SELL}, {1201, 101, 5, Side::SELL},
+      {1202, 99, 4, Side::BUY},   {1203, 101, 8, Side::BUY},
+      {1204, 100, 6, Side::SELL}, {1205, 98, 10, Side::SELL},
+      {1206, 102, 3, Side::SELL},
+  };
+  const size_t count = sizeof(orders) / sizeof(orders[0]);
+  Orderbook sequential;
+  Orderbook batched;
+  uint32_t matches[count];
+  match_orders(batched, orders, count, matches);
+  for (size_t i = 0; i < count; ++i)
+    assert(matches[i] == match_order(sequential, orders[i]));
+  assert(matches[3] == 2);
+  assert(matches[5] == 1);
+
+  IdType ids[] = {1201, 1205, 1206, 999};
+  QuantityType quantities[] = {1, 0, 2, 7};
+  modify_orders_by_id(batched, ids, quantities, 4);
+  for (size_t i = 0; i < 4; ++i)
+    modify_order_by_id(sequential, ids[i], quantities[i]);
+  for (PriceType price = 95; price < 105; ++price) {
+    assert(get_volume_at_level(batched, Side::BUY, price) ==
+           get_volume_at_level(sequential, Side::BUY, price));
+    assert(get_volume_at_level(batched, Side::SELL, price) ==
+           get_volume_at_level(sequential, Side::SELL, price));
+  }
+  assert(!order_exists(batched, 1205));
+  assert(lookup_order_by_id(batched, 1206).quantity == 2);
+
+  std::cout << "Test 36 passed." << std::endl;
+}
+
+// Test 37: Fill sink records every execution.
+void test_fill_sink() {
+  std::cout << "Test 37: Fill sink records every execution" << std::endl;
+  Orderbook ob;
+  // Matching without a sink records nothing.
+  Order sellOrder1{1300, 100, 5, Side::SELL};
+  Order buyOrder1{1301, 100, 2, Side::BUY};
+  match_order(ob, sellOrder1);
+  match_order(ob, buyOrder1);
+  assert(get_fill_count(ob) == 0);
+
+  Fill fills[4];
+  attach_fill_sink(ob, fills, 4);
+  Order sellOrder2{1302, 101, 4, Side::SELL};
+  match_order(ob, sellOrder2);
+  Order buyOrder2{1303, 101, 10, Side::BUY};
+  assert(match_order(ob, buyOrder2) == 2);
+  assert(get_fill_count(ob) == 2);
+  assert(fills[0].restingId == 1300 && fills[0].incomingId == 1303);
+  assert(fills[0].price == 100 && fills[0].quantity == 3);
+  assert(fills[1].restingId == 1302 && fills[1].price == 101);
+  assert(fills[1].quantity == 4);
+
+  // The ring wraps once more fills arrive than it holds.
+  for (IdType i = 0; i < 3; ++i) {
+    Order sell{1304 + i, 101, 1, Side::SELL};
+    match_order(ob, sell);
+  }
+  assert(get_fill_count(ob) == 5);
+  assert(fills[4 & 3].restingId == 1303 && fills[4 & 3].incomingId == 1306);
+
+  attach_fill_sink(ob, nullptr, 0);
+  Order sell{1307, 90, 10, Side::SELL};
+  match_order(ob, sell);
+  assert(get_fill_count(ob) == 0);
+
+  std::cout << "Test 37 passed." << std::endl;
+}
+
+// Test 38: Depth updates are coalesced per level and top-N skips gaps.
+void test_depth_feed() {
+  std::cout << "Test 38: Depth updates are coalesced per level and top-N "
+               "skips gaps"
+            << std::endl;
+  Orderbook ob;
+  DepthUpdate updates[64];
+  attach_depth_sink(ob, updates, 64);
+
+  // Two orders at each of three ask levels, spread out in price.
+  for (IdType i = 0; i < 6; ++i) {
+    Order sellOrder{1400 + i, (PriceType)(100 + (i / 2) * 50), 5, Side::SELL};
+    match_order(ob, sellOrder);
+  }
+  assert(get_depth_update_count(ob) == 6);
+  assert(updates[1].side == Side::SELL && updates[1].price == 100);
+  assert(updates[1].volume == 10);
+
+  DepthLevel levels[4];
+  assert(get_top_n_levels(ob, Side::SELL, 4, levels) == 3);
+  assert(levels[0].price == 100 && levels[0].volume == 10);
+  assert(levels[2].price == 200 && levels[2].volume == 10);
+  assert(get_top_n_levels(ob, Side::BUY, 4, levels) == 0);
+
+  // Sweep two levels, partially fill the third and rest nothing: one update
+  // per level touched, not one per order.
+  Order buyOrder{1410, 200, 23, Side::BUY};
+  assert(match_order(ob, buyOrder) == 5);
+  assert(get_depth_update_count(ob) == 9);
+  assert(updates[6].price == 100 && updates[6].volume == 0);
+  assert(updates[7].price == 150 && updates[7].volume == 0);
+  assert(updates[8].price == 200 && updates[8].volume == 7);
+
+  // Resting remainder, modify and cancel each emit a single update.
+  Order buyOrder2{1411, 210, 10, Side::BUY};
+  match_order(ob, buyOrder2);
+  assert(get_depth_update_count(ob) == 11);
+  assert(updates[10].side == Side::BUY && updates[10].price == 210);
+  assert(updates[10].volume == 3);
+  modify_order_by_id(ob, 1411, 1);
+  modify_order_by_id(ob, 1411, 1);
+  cancel_order_by_id(ob, 1411);
+  assert(get_depth_update_count(ob) == 13);
+  assert(updates[11].volume == 1 && updates[12].volume == 0);
+  assert(get_top_n_levels(ob, Side::SELL, 1, levels) == 0);
+
+  std::cout << "Test 38 passed." << std::endl;
+}
+
+// Test 39: Book manager routes commands to per-symbol books.
+void test_book_manager() {
+  std::cout << "Test 39: Book manager routes commands to per-symbol books"
+            << std::endl;
+  const uint32_t symbols = 6;
+  BookManager manager(symbols, 2, 64, 64);
+  assert(manager.worker_for(3) == 1);
+  // The same ids and prices on every symbol must not interact across books.
+  for (SymbolId s = 0; s < symbols; ++s) {
+    Order sellOrder{1, 100, 10, Side::SELL};
+    Order buyOrder{2, 100, (QuantityType)(s + 1), Side::BUY};
+    manager.submit({s, {OrderCommand::Type::NEW, sellOrder}});
+    manager.submit({s, {OrderCommand::Type::NEW, buyOrder}});
+  }
+  manager.submit({4, {OrderCommand::Type::CANCEL, {1, 0, 0, Side::SELL}}});
+  manager.wait_idle();
+
+  assert(manager.total_matches() == symbols);
+  for (SymbolId s = 0; s < symbols; ++s) {
+    uint32_t expected = s == 4 ? 0 : 10 - (s + 1);
+    assert(get_volume_at_level(manager.book(s), Side::SELL, 100) == expected);
+  }
+  assert(!order_exists(manager.book(4), 1));
+
+  // Symbols without a book are rejected before anything is queued.
+  Order strayOrder{3, 100, 1, Side::SELL};
+  bool threw = false;
+  try {
+    manager.try_submit({symbols, {OrderCommand::Type::NEW, strayOrder}});
+  } catch (const std::out_of_range &) {
+    threw = true;
+  }
+  assert(threw);
+  threw = false;
+  try {
+    manager.book(symbols);
+  } catch (const std::out_of_range &) {
+    threw = true;
+  }
+  assert(threw);
+  manager.wait_idle();
+  assert(manager.total_matches() == symbols);
+
+  std::cout << "Test 39 passed." << std::endl;
+}
+
+// Test 40: Ingress ring feeds the book in polling and blocking modes.
+void test_ingress_ring() {
+  std::cout << "Test 40: Ingress ring feeds the book in polling and blocking "
+               "modes"
+            << std::endl;
+  Orderbook ob;
+  IngressRing ring(4);
+  assert(poll_ingress(ob, ring) == 0);
+
+  // Fill the ring, then check it refuses more until drained.
+  Order sellOrder{1500, 100, 10, Side::SELL};
+  assert(ring.try_push({OrderCommand::Type::NEW, sellOrder}));
+  assert(ring.try_push({OrderCommand::Type::MODIFY, {1500, 0, 8, Side::SELL}}));
+  assert(ring.try_push({OrderCommand::Type::NEW, {1501, 100, 3, Side::BUY}}));
+  assert(ring.try_push({OrderCommand::Type::CANCEL, {1502, 0, 0, Side::SELL}}));
+  assert(!ring.try_push({OrderCommand::Type::NEW, sellOrder}));
+  assert(poll_ingress(ob, ring, 2) == 2);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 8);
+  assert(poll_ingress(ob, ring) == 2);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 5);
+
+  // A blocked consumer is woken by the producer thread.
+  const IdType count = 1000;
+  BlockingIngressRing blockingRing(4);
+  std::thread producer([&] {
+    for (IdType i = 0; i < count; ++i) {
+      Order buyOrder{2000 + i, 50, 1, Side::BUY};
+      while (!blockingRing.try_push({OrderCommand::Type::NEW, buyOrder}))
+        std::this_thread::yield();
+    }
+  });
+  size_t applied = 0;
+  while (applied < count)
+    applied += wait_ingress(ob, blockingRing);
+  producer.join();
+  assert(applied == count);
+  assert(get_volume_at_level(ob, Side::BUY, 50) == count);
+
+  std::cout << "Test 40 passed." << std::endl;
+}
+
+// Test 41: Journal replay reconstructs an identical book.
+void test_journal_replay() {
+  std::cout << "Test 41: Journal replay reconstructs an identical book"
+            << std::endl;
+  char path[] = "/tmp/lll_journal_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  Orderbook live;
+  {
+    // A tiny initial capacity forces the writer to grow its mapping.
+    JournalWriter journal(path, 2);
+    attach_journal(live, &journal);
+    for (IdType i = 0; i < 20; ++i) {
+      Order order{1600 + i, (PriceType)(95 + i % 10), (QuantityType)(1 + i),
+                  i % 3 ? Side::SELL : Side::BUY};
+      match_order(live, order);
+    }
+    modify_order_by_id(live, 1604, 2);
+    modify_order_by_id(live, 1605, 0);
+    cancel_order_by_id(live, 1608);
+    replace_order(live, 1610, 90, 3);
+    match_order_with_tif(live, Order{1620, 90, 2, Side::BUY},
+                         TimeInForce::IOC);
+    assert(journal.count() == 25);
+    attach_journal(live, nullptr);
+    // Not journaled, so the replayed book must not contain it.
+    Order extra{1700, 200, 1, Side::SELL};
+    match_order(live, extra);
+    cancel_order_by_id(live, 1700);
+  }
+
+  Orderbook replayed;
+  JournalReader journal(path);
+  assert(journal.size() == 25);
+  assert(replay_journal(journal, replayed) == 25);
+  for (PriceType price = 85; price < 110; ++price) {
+    assert(get_volume_at_level(live, Side::BUY, price) ==
+           get_volume_at_level(replayed, Side::BUY, price));
+    assert(get_volume_at_level(live, Side::SELL, price) ==
+           get_volume_at_level(replayed, Side::SELL, price));
+  }
+  for (IdType id = 1600; id <= 1620; ++id) {
+    assert(order_exists(live, id) == order_exists(replayed, id));
+    if (order_exists(live, id))
+      assert(lookup_order_by_id(live, id).quantity ==
+             lookup_order_by_id(replayed, id).quantity);
+  }
+  std::remove(path);
+
+  // A writer created with no room at all still grows on the first append.
+  char emptyPath[] = "/tmp/lll_journal_XXXXXX";
+  fd = mkstemp(emptyPath);
+  assert(fd >= 0);
+  close(fd);
+  {
+    JournalWriter empty(emptyPath, 0);
+    empty.append(OrderCommand::Type::NEW, 1800, 100, 5, Side::SELL);
+    empty.append(OrderCommand::Type::CANCEL, 1800, 0, 0, Side::BUY);
+  }
+  JournalReader grown(emptyPath);
+  assert(grown.size() == 2);
+  assert(grown[0].id == 1800 && grown[0].price == 100 &&
+         grown[0].quantity == 5 && grown[0].side == (uint8_t)Side::SELL);
+  assert(grown[1].type == (uint8_t)OrderCommand::Type::CANCEL);
+  std::remove(emptyPath);
+
+  std::cout << "Test 41 passed." << std::endl;
+}
+
+// Test 42: Snapshot round trip restores an identical, still usable book.
+void test_snapshot_round_trip() {
+  std::cout << "Test 42: Snapshot round trip restores an identical book"
+            << std::endl;
+  char path[] = "/tmp/lll_snapshot_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  Orderbook ob;
+  for (IdType i = 0; i < 40; ++i) {
+    Order order{1800 + i, (PriceType)(90 + i % 20), (QuantityType)(1 + i % 7),
+                i % 2 ? Side::SELL : Side::BUY};
+    match_order(ob, order);
+  }
+  // Leave holes in the queues and nodes on the pool's free list.
+  cancel_order_by_id(ob, 1830);
+  modify_order_by_id(ob, 1833, 0);
+  modify_order_by_id(ob, 1835, 1);
+  assert(save_orderbook_snapshot(ob, path));
+
+  Orderbook *restored = load_orderbook_snapshot(path);
+  assert(restored);
+  for (IdType id = 1800; id < 1840; ++id) {
+    assert(order_exists(ob, id) == order_exists(*restored, id));
+    if (!order_exists(ob, id))
+      continue;
+    Order a = lookup_order_by_id(ob, id);
+    Order b = lookup_order_by_id(*restored, id);
+    assert(a.price == b.price && a.quantity == b.quantity && a.side == b.side);
+  }
+  for (PriceType price = 85; price < 115; ++price) {
+    assert(get_volume_at_level(ob, Side::BUY, price) ==
+           get_volume_at_level(*restored, Side::BUY, price));
+    assert(get_volume_at_level(ob, Side::SELL, price) ==
+           get_volume_at_level(*restored, Side::SELL, price));
+  }
+  PoolStats before = get_order_pool_stats(ob);
+  PoolStats after = get_order_pool_stats(*restored);
+  assert(before.inUse == after.inUse && before.highWater == after.highWater);
+
+  // Both books must keep behaving identically, FIFO order included.
+  Order sweep{1900, 120, 60, Side::BUY};
+  Order rest{1901, 80, 5, Side::SELL};
+  assert(match_order(ob, sweep) == match_order(*restored, sweep));
+  assert(match_order(ob, rest) == match_order(*restored, rest));
+  for (PriceType price = 75; price < 125; ++price)
+    assert(get_volume_at_level(ob, Side::SELL, price) ==
+           get_volume_at_level(*restored, Side::SELL, price));
+  destroy_orderbook(restored);
+
+  // Garbage is rejected.
+  std::FILE *f = std::fopen(path, "wb");
+  std::fputs("not a snapshot", f);
+  std::fclose(f);
+  assert(load_orderbook_snapshot(path) == nullptr);
+  std::remove(path);
+  assert(load_orderbook_snapshot(path) == nullptr);
+
+  std::cout << "Test 42 passed." << std::endl;
+}
+
+// Test 43: A sweep through many resting orders fills them in FIFO order.
+void test_sweep_fifo() {
+  std::cout << "Test 43: A sweep through many resting orders fills them in "
+               "FIFO order"
+            << std::endl;
+  Orderbook ob;
+  Fill fills[64];
+  attach_fill_sink(ob, fills, 64);
+  // 20 asks at one level with varied sizes, then 5 more one tick higher.
+  uint32_t total = 0;
+  for (IdType i = 0; i < 20; ++i) {
+    Order sellOrder{1700 + i, 100, (QuantityType)(1 + i % 7), Side::SELL};
+    total += sellOrder.quantity;
+    match_order(ob, sellOrder);
+  }
+  for (IdType i = 0; i < 5; ++i) {
+    Order sellOrder{1720 + i, 101, 3, Side::SELL};
+    match_order(ob, sellOrder);
+  }
+
+  // Take the first level plus one and a half orders of the next.
+  Order buyOrder{1730, 101, (QuantityType)(total + 4), Side::BUY};
+  assert(match_order(ob, buyOrder) == 22);
+  assert(get_fill_count(ob) == 22);
+  for (IdType i = 0; i < 20; ++i) {
+    assert(fills[i].restingId == 1700 + i && fills[i].price == 100);
+    assert(fills[i].quantity == 1 + i % 7);
+    assert(!order_exists(ob, 1700 + i));
+  }
+  assert(fills[20].restingId == 1720 && fills[20].quantity == 3);
+  assert(fills[21].restingId == 1721 && fills[21].quantity == 1);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 0);
+  assert(get_volume_at_level(ob, Side::SELL, 101) == 11);
+  assert(lookup_order_by_id(ob, 1721).quantity == 2);
+  assert(!order_exists(ob, 1730));
+
+  // The level's FIFO is intact: the next sweep starts at the partial order
+  // and an exact fill leaves nothing behind.
+  Order buyOrder2{1731, 101, 11, Side::BUY};
+  assert(match_order(ob, buyOrder2) == 4);
+  assert(fills[22].restingId == 1721 && fills[22].quantity == 2);
+  assert(fills[25].restingId == 1724 && fills[25].quantity == 3);
+  assert(get_volume_at_level(ob, Side::SELL, 101) == 0);
+  assert(!order_exists(ob, 1731));
+  assert(get_order_pool_stats(ob).inUse == 0);
+
+  std::cout << "Test 43 passed." << std::endl;
+}
+
+// Test 44: Instrumentation histograms and the compiled-out default.
+void test_instrumentation() {
+  std::cout << "Test 44: Instrumentation histograms and the compiled-out "
+               "default"
+            << std::endl;
+  Log2Histogram h{};
+  for (uint64_t v : {0, 1, 2, 3, 100, 1000})
+    h.record(v);
+  assert(h.count == 6 && h.sum == 1106 && h.max == 1000);
+  assert(h.buckets[0] == 1 && h.buckets[1] == 1 && h.buckets[2] == 2);
+  assert(h.buckets[7] == 1 && h.buckets[10] == 1);
+  assert(h.quantile(0.0) == 0);
+  assert(h.quantile(0.5) == 3);
+  assert(h.quantile(0.99) == 1000);
+
+  // The test build leaves instrumentation out, so nothing is recorded.
+  Orderbook ob;
+  Order sellOrder{1800, 100, 5, Side::SELL};
+  Order buyOrder{1801, 100, 3, Side::BUY};
+  match_order(ob, sellOrder);
+  match_order(ob, buyOrder);
+  modify_order_by_id(ob, 1800, 1);
+  get_volume_at_level(ob, Side::SELL, 100);
+  InstrumentStats stats;
+  get_instrument_stats(ob, &stats);
+  assert(instrumentation_enabled() == kInstrumented);
+  if (!kInstrumented) {
+    assert(stats.matchCycles.count == 0 && stats.allocations == 0);
+  } else {
+    assert(stats.matchCycles.count == 2 && stats.modifyCycles.count == 1);
+    assert(stats.volumeCycles.count == 1 && stats.allocations == 1);
+    assert(stats.ordersPerMatch.sum == 1);
+  }
+  reset_instrument_stats(ob);
+  get_instrument_stats(ob, &stats);
+  assert(stats.matchCycles.count == 0);
+
+  std::cout << "Test 44 passed." << std::endl;
+}
+
+// Test 45: IOC, FOK and post-only orders never leave unwanted remainders.
+void test_time_in_force() {
+  std::cout << "Test 45: IOC, FOK and post-only orders never leave unwanted "
+               "remainders"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrder1{1900, 100, 5, Side::SELL};
+  Order sellOrder2{1901, 102, 5, Side::SELL};
+  match_order(ob, sellOrder1);
+  match_order(ob, sellOrder2);
+
+  // IOC takes what it can up to its price and drops the rest.
+  Order iocBuy{1902, 101, 8, Side::BUY};
+  assert(match_order_with_tif(ob, iocBuy, TimeInForce::IOC) == 1);
+  assert(!order_exists(ob, 1902) && !order_exists(ob, 1900));
+  assert(get_volume_at_level(ob, Side::BUY, 101) == 0);
+  assert(ob.bestBid == -1);
+
+  // FOK with too little liquidity inside its price does nothing at all.
+  Order sellOrder3{1903, 101, 4, Side::SELL};
+  match_order(ob, sellOrder3);
+  Order fokBuy{1904, 101, 5, Side::BUY};
+  assert(match_order_with_tif(ob, fokBuy, TimeInForce::FOK) == 0);
+  assert(lookup_order_by_id(ob, 1903).quantity == 4);
+  assert(!order_exists(ob, 1904));
+  // Reaching one level further makes it fillable across both levels.
+  Order fokBuy2{1905, 102, 6, Side::BUY};
+  assert(match_order_with_tif(ob, fokBuy2, TimeInForce::FOK) == 2);
+  assert(!order_exists(ob, 1903) && !order_exists(ob, 1905));
+  assert(lookup_order_by_id(ob, 1901).quantity == 3);
+
+  // Post-only rests when passive and is dropped when it would cross.
+  Order postBuy{1906, 101, 7, Side::BUY};
+  assert(match_order_with_tif(ob, postBuy, TimeInForce::POST_ONLY) == 0);
+  assert(get_volume_at_level(ob, Side::BUY, 101) == 7);
+  Order postSell{1907, 101, 2, Side::SELL};
+  assert(match_order_with_tif(ob, postSell, TimeInForce::POST_ONLY) == 0);
+  assert(!order_exists(ob, 1907));
+  assert(get_volume_at_level(ob, Side::BUY, 101) == 7);
+
+  bool threw = false;
+  try {
+    match_order_with_tif(ob, postSell, (TimeInForce)9);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  assert(threw);
+
+  std::cout << "Test 45 passed." << std::endl;
+}
+
+// Test 46: Increases lose queue priority and replace moves orders in one call.
+void test_modify_priority_and_replace() {
+  std::cout << "Test 46: Increases lose queue priority and replace moves "
+               "orders in one call"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrderA{2000, 100, 5, Side::SELL};
+  Order sellOrderB{2001, 100, 5, Side::SELL};
+  Order sellOrderC{2002, 100, 5, Side::SELL};
+  match_order(ob, sellOrderA);
+  match_order(ob, sellOrderB);
+  match_order(ob, sellOrderC);
+
+  // A reduces and keeps its place; B increases and goes behind C.
+  modify_order_by_id(ob, 2000, 2);
+  modify_order_by_id(ob, 2001, 8);
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 15);
+  Order buyOrder{2003, 100, 7, Side::BUY};
+  assert(match_order(ob, buyOrder) == 2);
+  assert(!order_exists(ob, 2000) && !order_exists(ob, 2002));
+  assert(lookup_order_by_id(ob, 2001).quantity == 8);
+
+  // Replacing at a new price that crosses matches like a fresh order and
+  // rests the remainder under the same id.
+  Order buyOrder2{2004, 98, 4, Side::BUY};
+  match_order(ob, buyOrder2);
+  assert(replace_order(ob, 2001, 98, 6) == 1);
+  assert(!order_exists(ob, 2004));
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 0);
+  assert(get_volume_at_level(ob, Side::SELL, 98) == 2);
+  Order moved = lookup_order_by_id(ob, 2001);
+  assert(moved.price == 98 && moved.quantity == 2 && moved.side == Side::SELL);
+  assert(ob.bestAsk == 98 && ob.bestBid == -1);
+
+  // Same price behaves like a modify; zero cancels; unknown ids are ignored.
+  assert(replace_order(ob, 2001, 98, 1) == 0);
+  assert(get_volume_at_level(ob, Side::SELL, 98) == 1);
+  assert(replace_order(ob, 2001, 99, 0) == 0);
+  assert(!order_exists(ob, 2001) && ob.bestAsk == (int32_t)kPriceLevels);
+  assert(replace_order(ob, 2001, 99, 5) == 0);
+  assert(!order_exists(ob, 2001));
+
+  std::cout << "Test 46 passed." << std::endl;
+}
+
+// Test 47: Book memory comes from one arena that grows in chunks.
+void test_orderbook_arena() {
+  std::cout << "Test 47: Book memory comes from one arena that grows in chunks"
+            << std::endl;
+  Orderbook *ob = create_orderbook();
+  ArenaStats stats = get_arena_stats(*ob);
+  // The default-sized book fits in its first chunk, on whole huge pages.
+  assert(stats.chunks == 1);
+  assert(stats.mappedBytes % Arena::kHugePage == 0);
+  assert(stats.usedBytes >= 2 * sizeof(PriceLevel) * kPriceLevels);
+  assert(stats.usedBytes <= stats.mappedBytes);
+  destroy_orderbook(ob);
+
+  // Outgrowing a tiny book maps more chunks without disturbing its contents.
+  ob = create_orderbook_with_capacity(4);
+  uint64_t used = get_arena_stats(*ob).usedBytes;
+  for (IdType i = 0; i < 100000; ++i) {
+    Order buyOrder{2100000 + i, (PriceType)(1000 + i % 500), 1, Side::BUY};
+    match_order(*ob, buyOrder);
+  }
+  stats = get_arena_stats(*ob);
+  assert(stats.chunks > 1 && stats.usedBytes > used);
+  assert(stats.usedBytes <= stats.mappedBytes);
+  assert(get_order_pool_stats(*ob).inUse == 100000);
+  assert(get_volume_at_level(*ob, Side::BUY, 1499) == 200);
+  assert(lookup_order_by_id(*ob, 2100000 + 99999).price == 1499);
+  destroy_orderbook(ob);
+
+  // An arena allocation honours its alignment and spills into a new chunk.
+  Arena arena(64);
+  void *small = arena.allocate(8, 8);
+  void *big = arena.allocate(3 * Arena::kHugePage, 4096);
+  assert((uintptr_t)small % 8 == 0 && (uintptr_t)big % 4096 == 0);
+  assert(arena.stats().chunks == 2);
+
+  std::cout << "Test 47 passed." << std::endl;
+}
+
+// Test 48: Level order counts follow inserts, fills, requeues and cancels.
+void test_level_order_count() {
+  std::cout << "Test 48: Level order counts follow inserts, fills, requeues "
+               "and cancels"
+            << std::endl;
+  Orderbook ob;
+  for (IdType i = 0; i < 12; ++i) {
+    Order sellOrder{2200 + i, (PriceType)(100 + i / 6), 2, Side::SELL};
+    match_order(ob, sellOrder);
+  }
+  assert(get_order_count_at_level(ob, Side::SELL, 100) == 6);
+  assert(get_order_count_at_level(ob, Side::SELL, 101) == 6);
+
+  // A sweep through the first level and into the second.
+  Order buyOrder{2212, 101, 15, Side::BUY};
+  assert(match_order(ob, buyOrder) == 8);
+  assert(get_order_count_at_level(ob, Side::SELL, 100) == 0);
+  assert(get_order_count_at_level(ob, Side::SELL, 101) == 5);
+
+  // Requeue, cancel and replace away.
+  modify_order_by_id(ob, 2208, 9);
+  assert(get_order_count_at_level(ob, Side::SELL, 101) == 5);
+  cancel_order_by_id(ob, 2209);
+  modify_order_by_id(ob, 2210, 0);
+  replace_order(ob, 2211, 105, 2);
+  assert(get_order_count_at_level(ob, Side::SELL, 101) == 2);
+  assert(get_order_count_at_level(ob, Side::SELL, 105) == 1);
+  assert(get_volume_at_level(ob, Side::SELL, 101) == 10);
+
+  std::cout << "Test 48 passed." << std::endl;
+}
+
+// Test 49: Self-trade prevention policies apply inline during the walk.
+void test_self_trade_prevention() {
+  std::cout << "Test 49: Self-trade prevention policies apply inline during "
+               "the walk"
+            << std::endl;
+  const OwnerId firmA = 7, firmB = 8;
+  auto setup = [&](Orderbook &ob, StpPolicy policy) {
+    set_self_trade_policy(ob, policy);
+    // B's order, then A's, then B's again at the same price.
+    match_order_as(ob, Order{2300, 100, 4, Side::SELL}, TimeInForce::GTC,
+                   firmB);
+    match_order_as(ob, Order{2301, 100, 5, Side::SELL}, TimeInForce::GTC,
+                   firmA);
+    match_order_as(ob, Order{2302, 100, 6, Side::SELL}, TimeInForce::GTC,
+                   firmB);
+  };
+
+  // Without a policy, owners are ignored.
+  {
+    Orderbook ob;
+    setup(ob, StpPolicy::NONE);
+    assert(match_order_as(ob, Order{2303, 100, 10, Side::BUY},
+                          TimeInForce::GTC, firmA) == 3);
+  }
+  // Cancel newest: the incoming order stops at its own resting order.
+  {
+    Orderbook ob;
+    setup(ob, StpPolicy::CANCEL_NEWEST);
+    assert(match_order_as(ob, Order{2303, 100, 10, Side::BUY},
+                          TimeInForce::GTC, firmA) == 1);
+    assert(!order_exists(ob, 2300) && !order_exists(ob, 2303));
+    assert(lookup_order_by_id(ob, 2301).quantity == 5);
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 11);
+  }
+  // Stopping at its own order at the touch leaves the level unchanged, so no
+  // depth update is published for it.
+  {
+    Orderbook ob;
+    set_self_trade_policy(ob, StpPolicy::CANCEL_NEWEST);
+    DepthUpdate updates[8];
+    attach_depth_sink(ob, updates, 8);
+    match_order_as(ob, Order{2330, 100, 5, Side::SELL}, TimeInForce::GTC,
+                   firmA);
+    assert(get_depth_update_count(ob) == 1);
+    assert(match_order_as(ob, Order{2331, 100, 5, Side::BUY},
+                          TimeInForce::GTC, firmA) == 0);
+    assert(get_depth_update_count(ob) == 1);
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 5);
+    assert(!order_exists(ob, 2331));
+  }
+  // Cancel oldest: the resting order is cancelled and matching continues.
+  {
+    Orderbook ob;
+    setup(ob, StpPolicy::CANCEL_OLDEST);
+    Fill fills[8];
+    attach_fill_sink(ob, fills, 8);
+    assert(match_order_as(ob, Order{2303, 100, 10, Side::BUY},
+                          TimeInForce::GTC, firmA) == 2);
+    assert(fills[0].restingId == 2300 && fills[1].restingId == 2302);
+    assert(!order_exists(ob, 2301) && !order_exists(ob, 2302));
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 0);
+    assert(get_order_count_at_level(ob, Side::SELL, 100) == 0);
+    assert(ob.bestAsk == (int32_t)kPriceLevels);
+    assert(!order_exists(ob, 2303));
+  }
+  // Decrement both: the smaller side is taken off both without a fill.
+  {
+    Orderbook ob;
+    setup(ob, StpPolicy::DECREMENT_BOTH);
+    assert(match_order_as(ob, Order{2303, 100, 12, Side::BUY},
+                          TimeInForce::GTC, firmA) == 2);
+    // 4 filled from 2300, 5 decremented against 2301, 3 filled from 2302.
+    assert(!order_exists(ob, 2301) && !order_exists(ob, 2303));
+    assert(lookup_order_by_id(ob, 2302).quantity == 3);
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 3);
+    assert(get_order_count_at_level(ob, Side::SELL, 100) == 1);
+    // Untagged orders never trigger the policy.
+    assert(match_order(ob, Order{2304, 100, 1, Side::BUY}) == 1);
+  }
+  // FOK stays all or nothing: own volume, and under CANCEL_NEWEST everything
+  // queued behind it, is not counted as fillable.
+  for (StpPolicy policy : {StpPolicy::CANCEL_NEWEST, StpPolicy::CANCEL_OLDEST,
+                           StpPolicy::DECREMENT_BOTH}) {
+    Orderbook ob;
+    setup(ob, policy);
+    Order fokBuy{2304, 100, 12, Side::BUY};
+    assert(match_order_as(ob, fokBuy, TimeInForce::FOK, firmA) == 0);
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 15);
+    assert(!order_exists(ob, 2304));
+    QuantityType fillable = policy == StpPolicy::CANCEL_OLDEST ? 10 : 4;
+    Order fokBuy2{2305, 100, fillable, Side::BUY};
+    uint32_t matches = match_order_as(ob, fokBuy2, TimeInForce::FOK, firmA);
+    assert(matches == (policy == StpPolicy::CANCEL_OLDEST ? 2u : 1u));
+    assert(!order_exists(ob, 2305) && !order_exists(ob, 2300));
+    assert(get_volume_at_level(ob, Side::SELL, 100) ==
+           (policy == StpPolicy::CANCEL_OLDEST ? 0u : 11u));
+  }
+  {
+    // Another owner's order queued ahead of the incoming owner's own.
+    Orderbook ob;
+    set_self_trade_policy(ob, StpPolicy::CANCEL_NEWEST);
+    match_order_as(ob, Order{2310, 100, 5, Side::SELL}, TimeInForce::GTC, 7);
+    match_order_as(ob, Order{2311, 100, 5, Side::SELL}, TimeInForce::GTC, 9);
+    match_order_as(ob, Order{2312, 100, 5, Side::SELL}, TimeInForce::GTC, 7);
+    assert(match_order_as(ob, Order{2313, 100, 12, Side::BUY},
+                          TimeInForce::FOK, 9) == 0);
+    assert(get_volume_at_level(ob, Side::SELL, 100) == 15);
+  }
+  // The policy is journaled, so replay makes the same self-trade decisions,
+  // whether it was set before the journal was attached or after.
+  for (bool setFirst : {true, false}) {
+    char path[] = "/tmp/lll_stp_journal_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    Orderbook live;
+    {
+      JournalWriter journal(path, 16);
+      if (setFirst)
+        set_self_trade_policy(live, StpPolicy::CANCEL_OLDEST);
+      attach_journal(live, &journal);
+      if (!setFirst)
+        set_self_trade_policy(live, StpPolicy::CANCEL_OLDEST);
+      match_order_as(live, Order{2320, 100, 5, Side::SELL}, TimeInForce::GTC,
+                     firmA);
+      match_order_as(live, Order{2321, 100, 5, Side::BUY}, TimeInForce::GTC,
+                     firmA);
+      attach_journal(live, nullptr);
+    }
+    assert(get_volume_at_level(live, Side::BUY, 100) == 5);
+    Orderbook replayed;
+    JournalReader journal(path);
+    assert(replay_journal(journal, replayed) == 3);
+    assert(replayed.stp == StpPolicy::CANCEL_OLDEST);
+    for (Side side : {Side::BUY, Side::SELL})
+      assert(get_volume_at_level(replayed, side, 100) ==
+             get_volume_at_level(live, side, 100));
+    assert(order_exists(replayed, 2321) && !order_exists(replayed, 2320));
+    std::remove(path);
+  }
+  // Tags and the policy survive a snapshot.
+  {
+    Orderbook ob;
+    setup(ob, StpPolicy::CANCEL_NEWEST);
+    char path[] = "/tmp/lll_stp_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(save_orderbook_snapshot(ob, path));
+    Orderbook *restored = load_orderbook_snapshot(path);
+    std::remove(path);
+    assert(restored && restored->stp == StpPolicy::CANCEL_NEWEST);
+    assert(match_order_as(*restored, Order{2303, 100, 10, Side::BUY},
+                          TimeInForce::GTC, firmA) == 1);
+    assert(lookup_order_by_id(*restored, 2301).quantity == 5);
+    destroy_orderbook(restored);
+  }
+
+  std::cout << "Test 49 passed." << std::endl;
+}
+
+// Test 50: Volume index answers match a level walk as the book changes.
+void test_volume_index() {
+  std::cout << "Test 50: Volume index answers match a level walk as the book "
+               "changes"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrder1{2400, 101, 5, Side::SELL};
+  Order sellOrder2{2401, 103, 7, Side::SELL};
+  Order buyOrder1{2402, 99, 4, Side::BUY};
+  Order buyOrder2{2403, 97, 6, Side::BUY};
+  match_order(ob, sellOrder1);
+  match_order(ob, sellOrder2);
+  match_order(ob, buyOrder1);
+  match_order(ob, buyOrder2);
+
+  // Without the index the queries walk levels; with it they must agree.
+  assert(get_volume_through_price(ob, Side::SELL, 102) == 5);
+  assert(get_price_for_quantity(ob, Side::SELL, 6) == 103);
+  enable_volume_index(ob);
+  assert(get_volume_through_price(ob, Side::SELL, 100) == 0);
+  assert(get_volume_through_price(ob, Side::SELL, 102) == 5);
+  assert(get_volume_through_price(ob, Side::SELL, 103) == 12);
+  assert(get_volume_through_price(ob, Side::BUY, 99) == 4);
+  assert(get_volume_through_price(ob, Side::BUY, 0) == 10);
+  assert(get_price_for_quantity(ob, Side::SELL, 5) == 101);
+  assert(get_price_for_quantity(ob, Side::SELL, 6) == 103);
+  assert(get_price_for_quantity(ob, Side::SELL, 13) == -1);
+  assert(get_price_for_quantity(ob, Side::BUY, 10) == 97);
+  assert(get_price_for_quantity(ob, Side::BUY, 0) == -1);
+
+  // FOK checks go through the index.
+  Order fokBuy{2404, 102, 6, Side::BUY};
+  assert(match_order_with_tif(ob, fokBuy, TimeInForce::FOK) == 0);
+  assert(get_volume_through_price(ob, Side::SELL, 103) == 12);
+  Order fokBuy2{2405, 103, 6, Side::BUY};
+  assert(match_order_with_tif(ob, fokBuy2, TimeInForce::FOK) == 2);
+  assert(get_volume_through_price(ob, Side::SELL, 103) == 6);
+
+  // Random traffic through every entry point keeps the index equal to a
+  // fresh walk of the same book.
+  Orderbook plain;
+  match_order(plain, Order{2401, 103, 6, Side::SELL});
+  match_order(plain, buyOrder1);
+  match_order(plain, buyOrder2);
+  uint32_t seed = 12345;
+  auto next = [&seed](uint32_t range) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % range;
+  };
+  for (IdType id = 2500; id < 3500; ++id) {
+    Side side = next(2) ? Side::BUY : Side::SELL;
+    PriceType price = (PriceType)(95 + next(12));
+    QuantityType quantity = (QuantityType)(1 + next(20));
+    IdType target = 2500 + next(id - 2500 + 1);
+    switch (next(5)) {
+    case 0:
+      modify_order_by_id(ob, target, quantity);
+      modify_order_by_id(plain, target, quantity);
+      break;
+    case 1:
+      cancel_order_by_id(ob, target);
+      cancel_order_by_id(plain, target);
+      break;
+    case 2:
+      assert(replace_order(ob, target, price, quantity) ==
+             replace_order(plain, target, price, quantity));
+      break;
+    case 3:
+      assert(match_order_with_tif(ob, Order{id, price, quantity, side},
+                                  TimeInForce::FOK) ==
+             match_order_with_tif(plain, Order{id, price, quantity, side},
+                                  TimeInForce::FOK));
+      break;
+    default:
+      assert(match_order(ob, Order{id, price, quantity, side}) ==
+             match_order(plain, Order{id, price, quantity, side}));
+    }
+    for (PriceType p = 94; p <= 107; ++p) {
+      assert(get_volume_through_price(ob, Side::BUY, p) ==
+             get_volume_through_price(plain, Side::BUY, p));
+      assert(get_volume_through_price(ob, Side::SELL, p) ==
+             get_volume_through_price(plain, Side::SELL, p));
+    }
+    for (uint64_t q = 1; q <= 60; q += 7) {
+      assert(get_price_for_quantity(ob, Side::BUY, q) ==
+             get_price_for_quantity(plain, Side::BUY, q));
+      assert(get_price_for_quantity(ob, Side::SELL, q) ==
+             get_price_for_quantity(plain, Side::SELL, q));
+    }
+  }
+
+  // The index is rebuilt when a snapshot is loaded.
+  char path[] = "/tmp/lll_volume_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  assert(save_orderbook_snapshot(ob, path));
+  Orderbook *restored = load_orderbook_snapshot(path);
+  std::remove(path);
+  assert(restored && restored->buyVolume && restored->sellVolume);
+  for (PriceType p = 94; p <= 107; ++p)
+    assert(get_volume_through_price(*restored, Side::SELL, p) ==
+           get_volume_through_price(plain, Side::SELL, p));
+  destroy_orderbook(restored);
+
+  std::cout << "Test 50 passed." << std::endl;
+}
+
+// Test 51: Simulated matches report exactly what match_order then does.
+void test_simulate_match() {
+  std::cout << "Test 51: Simulated matches report exactly what match_order "
+               "then does"
+            << std::endl;
+  Orderbook ob;
+  Order sellOrder1{2600, 100, 5, Side::SELL};
+  Order sellOrder2{2601, 100, 3, Side::SELL};
+  Order sellOrder3{2602, 102, 6, Side::SELL};
+  match_order(ob, sellOrder1);
+  match_order(ob, sellOrder2);
+  match_order(ob, sellOrder3);
+
+  // Takes the whole of 100 and part of 102, and rests the rest at 102.
+  SimLevel levels[4];
+  SimResult result = {};
+  result.levels = levels;
+  result.levelCapacity = 4;
+  Order buyOrder{2603, 102, 12, Side::BUY};
+  assert(simulate_match(ob, buyOrder, &result) == 3);
+  assert(result.levelCount == 2 && result.matchCount == 3);
+  assert(levels[0].price == 100 && levels[0].quantity == 8 &&
+         levels[0].orders == 2);
+  assert(levels[1].price == 102 && levels[1].quantity == 4 &&
+         levels[1].orders == 1);
+  assert(result.filledQuantity == 12 && result.notional == 1208);
+  assert(result.averagePrice > 100.66 && result.averagePrice < 100.67);
+  assert(result.restingQuantity == 0);
+  // The book is untouched.
+  assert(get_volume_at_level(ob, Side::SELL, 100) == 8);
+  assert(lookup_order_by_id(ob, 2602).quantity == 6);
+
+  // Time in force is applied the way match_order_with_tif applies it.
+  Order bigBuy{2604, 102, 20, Side::BUY};
+  assert(simulate_match(ob, bigBuy, &result) == 3);
+  assert(result.restingQuantity == 6);
+  assert(simulate_match_with_tif(ob, bigBuy, TimeInForce::IOC, &result) == 3);
+  assert(result.filledQuantity == 14 && result.restingQuantity == 0);
+  assert(simulate_match_with_tif(ob, bigBuy, TimeInForce::FOK, &result) == 0);
+  assert(result.levelCount == 0 && result.filledQuantity == 0);
+  assert(simulate_match_with_tif(ob, bigBuy, TimeInForce::POST_ONLY,
+                                 &result) == 0);
+  Order passiveBuy{2605, 99, 4, Side::BUY};
+  assert(simulate_match_with_tif(ob, passiveBuy, TimeInForce::POST_ONLY,
+                                 &result) == 0);
+  assert(result.restingQuantity == 4 && result.averagePrice == 0);
+
+  // Levels beyond the buffer are counted but not written.
+  result.levelCapacity = 1;
+  assert(simulate_match(ob, buyOrder, &result) == 3);
+  assert(result.levelCount == 2 && levels[0].quantity == 8);
+  result.levels = nullptr;
+  assert(simulate_match(ob, buyOrder, &result) == 3);
+
+  // Random traffic: each simulation agrees with the fills the real call
+  // produces right after it.
+  Fill fills[256];
+  attach_fill_sink(ob, fills, 256);
+  SimLevel walked[64];
+  result.levels = walked;
+  result.levelCapacity = 64;
+  uint32_t seed = 777;
+  auto next = [&seed](uint32_t range) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % range;
+  };
+  for (IdType id = 2700; id < 4700; ++id) {
+    Side side = next(2) ? Side::BUY : Side::SELL;
+    Order incoming{id, (PriceType)(90 + next(20)),
+                   (QuantityType)(1 + next(next(4) ? 10 : 60)), side};
+    TimeInForce tif = (TimeInForce)next(4);
+    uint32_t simulated =
+        simulate_match_with_tif(ob, incoming, tif, &result);
+    uint64_t before = get_fill_count(ob);
+    assert(match_order_with_tif(ob, incoming, tif) == simulated);
+    uint64_t after = get_fill_count(ob);
+    assert(after - before == simulated && simulated <= 256);
+    uint64_t filled = 0, notional = 0;
+    uint32_t level = 0, ordersAtLevel = 0, quantityAtLevel = 0;
+    for (uint64_t n = before; n < after; ++n) {
+      const Fill &fill = fills[n & 255];
+      if (fill.price != walked[level].price) {
+        assert(quantityAtLevel == walked[level].quantity &&
+               ordersAtLevel == walked[level].orders);
+        ++level;
+        ordersAtLevel = quantityAtLevel = 0;
+        assert(fill.price == walked[level].price);
+      }
+      ++ordersAtLevel;
+      quantityAtLevel += fill.quantity;
+      filled += fill.quantity;
+      notional += (uint64_t)fill.price * fill.quantity;
+    }
+    if (simulated)
+      assert(quantityAtLevel == walked[level].quantity &&
+             ordersAtLevel == walked[level].orders);
+    assert(filled == result.filledQuantity && notional == result.notional);
+    assert(result.levelCount == (simulated ? level + 1 : 0));
+    if (result.restingQuantity)
+      assert(lookup_order_by_id(ob, id).quantity == result.restingQuantity);
+    else
+      assert(!order_exists(ob, id));
+    if (next(3) == 0)
+      cancel_order_by_id(ob, 2700 + next(id - 2700 + 1));
+  }
+
+  std::cout << "Test 51 passed." << std::endl;
+}
+
 int main() {
   auto start = std::chrono::steady_clock::now();
   for (int i = 0; i<20; ++i)
@@ -751,6 +1983,29 @@ int main() {
   test_get_volume_complex2();
   test_get_volume_complex3();
   test_get_volume_all_encompassing();
+  test_price_bitmap();
+  test_sweep_sparse_levels();
+  test_volume_aggregate_consistency();
+  test_order_pool_stats();
+  test_cancel_unlinks_order();
+  test_touch_level_memory_bounded();
+  test_order_index();
+  test_batch_matches_sequential();
+  test_fill_sink();
+  test_depth_feed();
+  test_book_manager();
+  test_ingress_ring();
+  test_journal_replay();
+  test_snapshot_round_trip();
+  test_sweep_fifo();
+  test_instrumentation();
+  test_time_in_force();
+  test_modify_priority_and_replace();
+  test_orderbook_arena();
+  test_level_order_count();
+  test_self_trade_prevention();
+  test_volume_index();
+  test_simulate_match();
   std::cout << "All tests passed." << std::endl;
   }
 
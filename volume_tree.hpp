@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+// Fenwick tree of resting volume over the 16-bit price domain. Adding to one
+// price and summing the volume of every price below a bound both touch at
+// most 17 entries, as does finding how far up the domain a given volume
+// reaches. The tree is a flat array of counts with no pointers, so it is
+// trivially copyable and can be placed in an arena.
+class VolumeTree {
+public:
+  static constexpr uint32_t kSize = 1u << 16;
+
+  void add(uint32_t price, int64_t delta) {
+    for (uint32_t i = price + 1; i <= kSize; i += i & -i)
+      tree[i] += (uint64_t)delta;
+  }
+
+  // Total volume at prices [0, count)
+  uint64_t prefix(uint32_t count) const {
+    uint64_t sum = 0;
+    for (uint32_t i = count; i > 0; i -= i & -i)
+      sum += tree[i];
+    return sum;
+  }
+
+  uint64_t total() const { return tree[kSize]; }
+
+  // Largest count in [0, kSize] with prefix(count) <= target
+  uint32_t max_count_within(uint64_t target) const {
+    uint32_t count = 0;
+    for (uint32_t step = kSize; step > 0; step >>= 1) {
+      uint32_t next = count + step;
+      if (next <= kSize && tree[next] <= target) {
+        count = next;
+        target -= tree[next];
+      }
+    }
+    return count;
+  }
+
+  // Rebuilds the tree in O(kSize) from per-price volumes
+  template <typename VolumeAt> void build(VolumeAt volumeAt) {
+    for (uint32_t i = 1; i <= kSize; ++i)
+      tree[i] = volumeAt(i - 1);
+    for (uint32_t i = 1; i <= kSize; ++i) {
+      uint32_t parent = i + (i & -i);
+      if (parent <= kSize)
+        tree[parent] += tree[i];
+    }
+  }
+
+private:
+  uint64_t tree[kSize + 1] = {};
+};